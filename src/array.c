@@ -0,0 +1,582 @@
+#include "include/array.h"
+#include "include/gc.h"
+#include "include/pool.h"
+#include "include/value.h"
+#include <Pigeon/defines.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The kernels go a whole vector at a time where the compiler lets us,
+// same as the lexer, and finish the last few elements one by one. Both
+// widths have f64 math and i64 add and sub, i64 compares and min/max
+// need AVX2. There's no packed 64 bit multiply before AVX-512, so i64
+// * and dot stay scalar.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define ARR_WIDTH 4
+#define ARR_I64_CMP
+typedef __m256d ArrF64;
+typedef __m256i ArrI64;
+#define f64_load(p)        _mm256_loadu_pd(p)
+#define f64_store(p, v)    _mm256_storeu_pd(p, v)
+#define f64_set1(x)        _mm256_set1_pd(x)
+#define f64_add(a, b)      _mm256_add_pd(a, b)
+#define f64_sub(a, b)      _mm256_sub_pd(a, b)
+#define f64_mul(a, b)      _mm256_mul_pd(a, b)
+#define f64_div(a, b)      _mm256_div_pd(a, b)
+#define f64_min(a, b)      _mm256_min_pd(a, b)
+#define f64_max(a, b)      _mm256_max_pd(a, b)
+#define f64_eq(a, b)       _mm256_castpd_si256(_mm256_cmp_pd(a, b, _CMP_EQ_OQ))
+#define f64_neq(a, b)      _mm256_castpd_si256(_mm256_cmp_pd(a, b, _CMP_NEQ_UQ))
+#define f64_lt(a, b)       _mm256_castpd_si256(_mm256_cmp_pd(a, b, _CMP_LT_OQ))
+#define f64_lte(a, b)      _mm256_castpd_si256(_mm256_cmp_pd(a, b, _CMP_LE_OQ))
+#define i64_load(p)        _mm256_loadu_si256((const __m256i*)(p))
+#define i64_store(p, v)    _mm256_storeu_si256((__m256i*)(p), v)
+#define i64_set1(x)        _mm256_set1_epi64x(x)
+#define i64_add(a, b)      _mm256_add_epi64(a, b)
+#define i64_sub(a, b)      _mm256_sub_epi64(a, b)
+#define i64_and(a, b)      _mm256_and_si256(a, b)
+#define i64_andnot(a, b)   _mm256_andnot_si256(a, b)
+#define i64_eq(a, b)       _mm256_cmpeq_epi64(a, b)
+#define i64_gt(a, b)       _mm256_cmpgt_epi64(a, b)
+#define i64_blend(a, b, m) _mm256_blendv_epi8(a, b, m)
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define ARR_WIDTH 2
+typedef __m128d ArrF64;
+typedef __m128i ArrI64;
+#define f64_load(p)        _mm_loadu_pd(p)
+#define f64_store(p, v)    _mm_storeu_pd(p, v)
+#define f64_set1(x)        _mm_set1_pd(x)
+#define f64_add(a, b)      _mm_add_pd(a, b)
+#define f64_sub(a, b)      _mm_sub_pd(a, b)
+#define f64_mul(a, b)      _mm_mul_pd(a, b)
+#define f64_div(a, b)      _mm_div_pd(a, b)
+#define f64_min(a, b)      _mm_min_pd(a, b)
+#define f64_max(a, b)      _mm_max_pd(a, b)
+#define f64_eq(a, b)       _mm_castpd_si128(_mm_cmpeq_pd(a, b))
+#define f64_neq(a, b)      _mm_castpd_si128(_mm_cmpneq_pd(a, b))
+#define f64_lt(a, b)       _mm_castpd_si128(_mm_cmplt_pd(a, b))
+#define f64_lte(a, b)      _mm_castpd_si128(_mm_cmple_pd(a, b))
+#define i64_load(p)        _mm_loadu_si128((const __m128i*)(p))
+#define i64_store(p, v)    _mm_storeu_si128((__m128i*)(p), v)
+#define i64_set1(x)        _mm_set1_epi64x(x)
+#define i64_add(a, b)      _mm_add_epi64(a, b)
+#define i64_sub(a, b)      _mm_sub_epi64(a, b)
+#define i64_and(a, b)      _mm_and_si128(a, b)
+#define i64_andnot(a, b)   _mm_andnot_si128(a, b)
+#endif
+
+// One side of an element-wise op is either an array, stepped through
+// with a stride of 1, or a single number used for every element with a
+// stride of 0. The vector loops leave i at the first element they
+// didn't get to.
+#ifdef ARR_WIDTH
+#define F64_VEC(body) \
+    for (; i + ARR_WIDTH <= n; i += ARR_WIDTH) { \
+        ArrF64 x = as ? f64_load(a + i) : f64_set1(a[0]); \
+        ArrF64 y = bs ? f64_load(b + i) : f64_set1(b[0]); \
+        body; \
+    }
+#define I64_VEC(body) \
+    for (; i + ARR_WIDTH <= n; i += ARR_WIDTH) { \
+        ArrI64 x = as ? i64_load(a + i) : i64_set1(a[0]); \
+        ArrI64 y = bs ? i64_load(b + i) : i64_set1(b[0]); \
+        body; \
+    }
+#else
+#define F64_VEC(body)
+#define I64_VEC(body)
+#endif
+
+static i64 cmp_f64(ArrayOp op, f64 x, f64 y) {
+    switch (op) {
+        case ARRAY_EQ:  return x == y;
+        case ARRAY_NEQ: return x != y;
+        case ARRAY_LT:  return x < y;
+        case ARRAY_LTE: return x <= y;
+        case ARRAY_GT:  return x > y;
+        case ARRAY_GTE: return x >= y;
+        default:        return 0;
+    }
+}
+
+static i64 cmp_i64(ArrayOp op, i64 x, i64 y) {
+    switch (op) {
+        case ARRAY_EQ:  return x == y;
+        case ARRAY_NEQ: return x != y;
+        case ARRAY_LT:  return x < y;
+        case ARRAY_LTE: return x <= y;
+        case ARRAY_GT:  return x > y;
+        case ARRAY_GTE: return x >= y;
+        default:        return 0;
+    }
+}
+
+static void kernel_f64_op(ArrayOp op, f64* dst, const f64* a, usize as, const f64* b, usize bs, u64 n) {
+    u64 i = 0;
+
+    switch (op) {
+        case ARRAY_ADD: F64_VEC(f64_store(dst + i, f64_add(x, y))); break;
+        case ARRAY_SUB: F64_VEC(f64_store(dst + i, f64_sub(x, y))); break;
+        case ARRAY_MUL: F64_VEC(f64_store(dst + i, f64_mul(x, y))); break;
+        case ARRAY_DIV: F64_VEC(f64_store(dst + i, f64_div(x, y))); break;
+        default: break;
+    }
+
+    for (; i < n; ++i) {
+        f64 x = a[i * as];
+        f64 y = b[i * bs];
+
+        switch (op) {
+            case ARRAY_ADD: dst[i] = x + y; break;
+            case ARRAY_SUB: dst[i] = x - y; break;
+            case ARRAY_MUL: dst[i] = x * y; break;
+            case ARRAY_DIV: dst[i] = x / y; break;
+            default: break;
+        }
+    }
+}
+
+static void kernel_f64_cmp(ArrayOp op, i64* dst, const f64* a, usize as, const f64* b, usize bs, u64 n) {
+    u64 i = 0;
+
+#ifdef ARR_WIDTH
+    // Lanes that hold come back all ones, keep just the low bit
+    ArrI64 one = i64_set1(1);
+
+    switch (op) {
+        case ARRAY_EQ:  F64_VEC(i64_store(dst + i, i64_and(f64_eq(x, y), one)));  break;
+        case ARRAY_NEQ: F64_VEC(i64_store(dst + i, i64_and(f64_neq(x, y), one))); break;
+        case ARRAY_LT:  F64_VEC(i64_store(dst + i, i64_and(f64_lt(x, y), one)));  break;
+        case ARRAY_LTE: F64_VEC(i64_store(dst + i, i64_and(f64_lte(x, y), one))); break;
+        case ARRAY_GT:  F64_VEC(i64_store(dst + i, i64_and(f64_lt(y, x), one)));  break;
+        case ARRAY_GTE: F64_VEC(i64_store(dst + i, i64_and(f64_lte(y, x), one))); break;
+        default: break;
+    }
+#endif
+
+    for (; i < n; ++i) {
+        dst[i] = cmp_f64(op, a[i * as], b[i * bs]);
+    }
+}
+
+// Wraps around on overflow like the vector lanes do
+static void kernel_i64_op(ArrayOp op, i64* dst, const i64* a, usize as, const i64* b, usize bs, u64 n) {
+    u64 i = 0;
+
+    switch (op) {
+        case ARRAY_ADD: I64_VEC(i64_store(dst + i, i64_add(x, y))); break;
+        case ARRAY_SUB: I64_VEC(i64_store(dst + i, i64_sub(x, y))); break;
+        default: break;
+    }
+
+    for (; i < n; ++i) {
+        u64 x = a[i * as];
+        u64 y = b[i * bs];
+
+        switch (op) {
+            case ARRAY_ADD: dst[i] = x + y; break;
+            case ARRAY_SUB: dst[i] = x - y; break;
+            case ARRAY_MUL: dst[i] = x * y; break;
+            default: break;
+        }
+    }
+}
+
+static void kernel_i64_cmp(ArrayOp op, i64* dst, const i64* a, usize as, const i64* b, usize bs, u64 n) {
+    u64 i = 0;
+
+#ifdef ARR_I64_CMP
+    ArrI64 one = i64_set1(1);
+
+    switch (op) {
+        case ARRAY_EQ:  I64_VEC(i64_store(dst + i, i64_and(i64_eq(x, y), one)));    break;
+        case ARRAY_NEQ: I64_VEC(i64_store(dst + i, i64_andnot(i64_eq(x, y), one))); break;
+        case ARRAY_LT:  I64_VEC(i64_store(dst + i, i64_and(i64_gt(y, x), one)));    break;
+        case ARRAY_LTE: I64_VEC(i64_store(dst + i, i64_andnot(i64_gt(x, y), one))); break;
+        case ARRAY_GT:  I64_VEC(i64_store(dst + i, i64_and(i64_gt(x, y), one)));    break;
+        case ARRAY_GTE: I64_VEC(i64_store(dst + i, i64_andnot(i64_gt(y, x), one))); break;
+        default: break;
+    }
+#endif
+
+    for (; i < n; ++i) {
+        dst[i] = cmp_i64(op, a[i * as], b[i * bs]);
+    }
+}
+
+static f64 kernel_f64_sum(const f64* a, u64 n) {
+    u64 i = 0;
+    f64 sum = 0;
+
+#ifdef ARR_WIDTH
+    ArrF64 acc = f64_set1(0);
+    for (; i + ARR_WIDTH <= n; i += ARR_WIDTH) {
+        acc = f64_add(acc, f64_load(a + i));
+    }
+
+    f64 lanes[ARR_WIDTH];
+    f64_store(lanes, acc);
+    for (usize l = 0; l < ARR_WIDTH; ++l) {
+        sum += lanes[l];
+    }
+#endif
+
+    for (; i < n; ++i) {
+        sum += a[i];
+    }
+    return sum;
+}
+
+static i64 kernel_i64_sum(const i64* a, u64 n) {
+    u64 i = 0;
+    u64 sum = 0;
+
+#ifdef ARR_WIDTH
+    ArrI64 acc = i64_set1(0);
+    for (; i + ARR_WIDTH <= n; i += ARR_WIDTH) {
+        acc = i64_add(acc, i64_load(a + i));
+    }
+
+    i64 lanes[ARR_WIDTH];
+    i64_store(lanes, acc);
+    for (usize l = 0; l < ARR_WIDTH; ++l) {
+        sum += lanes[l];
+    }
+#endif
+
+    for (; i < n; ++i) {
+        sum += a[i];
+    }
+    return sum;
+}
+
+// n is at least 1 for min and max
+static f64 kernel_f64_extreme(const f64* a, u64 n, bool max) {
+    u64 i = 0;
+    f64 best = a[0];
+
+#ifdef ARR_WIDTH
+    ArrF64 acc = f64_set1(a[0]);
+    for (; i + ARR_WIDTH <= n; i += ARR_WIDTH) {
+        ArrF64 x = f64_load(a + i);
+        acc = max ? f64_max(acc, x) : f64_min(acc, x);
+    }
+
+    f64 lanes[ARR_WIDTH];
+    f64_store(lanes, acc);
+    for (usize l = 0; l < ARR_WIDTH; ++l) {
+        if (max ? lanes[l] > best : lanes[l] < best) best = lanes[l];
+    }
+#endif
+
+    for (; i < n; ++i) {
+        if (max ? a[i] > best : a[i] < best) best = a[i];
+    }
+    return best;
+}
+
+static i64 kernel_i64_extreme(const i64* a, u64 n, bool max) {
+    u64 i = 0;
+    i64 best = a[0];
+
+#ifdef ARR_I64_CMP
+    ArrI64 acc = i64_set1(a[0]);
+    for (; i + ARR_WIDTH <= n; i += ARR_WIDTH) {
+        ArrI64 x = i64_load(a + i);
+        ArrI64 take = max ? i64_gt(x, acc) : i64_gt(acc, x);
+        acc = i64_blend(acc, x, take);
+    }
+
+    i64 lanes[ARR_WIDTH];
+    i64_store(lanes, acc);
+    for (usize l = 0; l < ARR_WIDTH; ++l) {
+        if (max ? lanes[l] > best : lanes[l] < best) best = lanes[l];
+    }
+#endif
+
+    for (; i < n; ++i) {
+        if (max ? a[i] > best : a[i] < best) best = a[i];
+    }
+    return best;
+}
+
+static f64 kernel_f64_dot(const f64* a, const f64* b, u64 n) {
+    u64 i = 0;
+    f64 dot = 0;
+
+#ifdef ARR_WIDTH
+    ArrF64 acc = f64_set1(0);
+    for (; i + ARR_WIDTH <= n; i += ARR_WIDTH) {
+        acc = f64_add(acc, f64_mul(f64_load(a + i), f64_load(b + i)));
+    }
+
+    f64 lanes[ARR_WIDTH];
+    f64_store(lanes, acc);
+    for (usize l = 0; l < ARR_WIDTH; ++l) {
+        dot += lanes[l];
+    }
+#endif
+
+    for (; i < n; ++i) {
+        dot += a[i] * b[i];
+    }
+    return dot;
+}
+
+static i64 kernel_i64_dot(const i64* a, const i64* b, u64 n) {
+    u64 dot = 0;
+    for (u64 i = 0; i < n; ++i) {
+        dot += (u64)a[i] * (u64)b[i];
+    }
+    return dot;
+}
+
+Array* array_new(ArrayKind kind, u64 len) {
+    Array* arr = pool_alloc(POOL_ARRAY);
+    arr->kind = kind;
+    arr->len = len;
+    arr->at.ints = NULL;
+
+    if (len > 0) {
+        arr->at.ints = malloc(len * sizeof(i64));
+        ASSERT(arr->at.ints != NULL, "outta ram");
+    }
+    return arr;
+}
+
+void array_free(Array* arr) {
+    free(arr->at.ints);
+    pool_free(POOL_ARRAY, arr);
+}
+
+Value* array_item(Array* arr, u64 i, Gc* gc) {
+    if (arr->kind == ARRAY_I64) {
+        return value_int(arr->at.ints[i], gc);
+    }
+    return value_real(arr->at.reals[i], gc);
+}
+
+static bool is_number(Value* val) {
+    return value_tag(val) == VALUE_INTEGER || value_tag(val) == VALUE_REAL;
+}
+
+static void array_put(Array* arr, u64 i, Value* num) {
+    if (arr->kind == ARRAY_I64) {
+        arr->at.ints[i] = value_tag(num) == VALUE_REAL ? (i64)value_as_real(num) : value_as_int(num);
+    } else {
+        arr->at.reals[i] = value_tag(num) == VALUE_REAL ? value_as_real(num) : (f64)value_as_int(num);
+    }
+}
+
+static void array_convert(Array* dst, Array* src) {
+    for (u64 i = 0; i < src->len; ++i) {
+        if (dst->kind == src->kind) {
+            dst->at.ints[i] = src->at.ints[i];
+        } else if (dst->kind == ARRAY_I64) {
+            dst->at.ints[i] = (i64)src->at.reals[i];
+        } else {
+            dst->at.reals[i] = (f64)src->at.ints[i];
+        }
+    }
+}
+
+// Ranges and arrays are filled in directly, anything else that can be
+// walked goes through Value_Iter. Nil if seq can't be walked.
+Value* array_from(Gc* gc, Env* env, ArrayKind kind, Value* seq) {
+    Array* arr;
+
+    switch (value_tag(seq)) {
+        case VALUE_RANGE: {
+            Range r = VALUE_GET(seq, VALUE_RANGE);
+            arr = array_new(kind, range_len(r));
+
+            for (u64 i = 0; i < arr->len; ++i) {
+                i64 x = r.start + (i64)i * r.step;
+                if (kind == ARRAY_I64) {
+                    arr->at.ints[i] = x;
+                } else {
+                    arr->at.reals[i] = x;
+                }
+            }
+            break;
+        }
+        case VALUE_ARRAY: {
+            Array* src = VALUE_GET(seq, VALUE_ARRAY);
+            arr = array_new(kind, src->len);
+            array_convert(arr, src);
+            break;
+        }
+        default: {
+            Value_Iter it;
+            Value* item;
+            u64 cap = 0;
+
+            if (!value_iter_start(&it, gc, env, seq)) {
+                gc_pop_roots(gc, it.root);
+                return WISP_NIL;
+            }
+
+            // A lazy sequence doesn't know its length, grow as it goes
+            arr = array_new(kind, 0);
+            while (value_iter_next(&it, &item)) {
+                if (arr->len >= cap) {
+                    cap = cap == 0 ? DATA_START_CAPACITY : cap * 2;
+                    arr->at.ints = realloc(arr->at.ints, cap * sizeof(i64));
+                    ASSERT(arr->at.ints != NULL, "outta ram");
+                }
+
+                array_put(arr, arr->len++, item);
+            }
+
+            gc_pop_roots(gc, it.root);
+            break;
+        }
+    }
+
+    return value_alloc(VALUE_NEW(VALUE_ARRAY, arr), gc);
+}
+
+// Nil if any of nums isn't a number
+Value* array_pack(Gc* gc, ArrayKind kind, Value_Vec nums) {
+    for (usize i = 0; i < nums.len; ++i) {
+        if (!is_number(nums.at[i])) {
+            return WISP_NIL;
+        }
+    }
+
+    Array* arr = array_new(kind, nums.len);
+    for (usize i = 0; i < nums.len; ++i) {
+        array_put(arr, i, nums.at[i]);
+    }
+
+    return value_alloc(VALUE_NEW(VALUE_ARRAY, arr), gc);
+}
+
+// One side of an op as f64s. An i64 array is converted into a buffer
+// the caller frees, a number is copied to *num and read with stride 0.
+static f64* f64_operand(Value* val, Array* arr, f64* num, bool* owned) {
+    *owned = false;
+
+    if (arr == NULL) {
+        *num = value_tag(val) == VALUE_REAL ? value_as_real(val) : (f64)value_as_int(val);
+        return num;
+    }
+
+    if (arr->kind == ARRAY_F64) {
+        return arr->at.reals;
+    }
+
+    f64* reals = malloc(arr->len * sizeof(f64));
+    ASSERT(arr->len == 0 || reals != NULL, "outta ram");
+    for (u64 i = 0; i < arr->len; ++i) {
+        reals[i] = arr->at.ints[i];
+    }
+
+    *owned = true;
+    return reals;
+}
+
+// Either side can be a number that goes with every element. The result
+// is f64 if either side is, or for a division, otherwise i64.
+Value* array_binary(Gc* gc, ArrayOp op, Value* a, Value* b) {
+    Array* x = value_tag(a) == VALUE_ARRAY ? VALUE_GET(a, VALUE_ARRAY) : NULL;
+    Array* y = value_tag(b) == VALUE_ARRAY ? VALUE_GET(b, VALUE_ARRAY) : NULL;
+
+    if ((x == NULL && !is_number(a)) || (y == NULL && !is_number(b))) {
+        return WISP_NIL;
+    }
+
+    if (x != NULL && y != NULL && x->len != y->len) {
+        return WISP_NIL;
+    }
+
+    u64 n = x != NULL ? x->len : y->len;
+    usize as = x != NULL;
+    usize bs = y != NULL;
+    bool cmp = op >= ARRAY_EQ;
+    bool real = op == ARRAY_DIV ||
+                (x != NULL ? x->kind == ARRAY_F64 : value_tag(a) == VALUE_REAL) ||
+                (y != NULL ? y->kind == ARRAY_F64 : value_tag(b) == VALUE_REAL);
+
+    Array* dst = array_new(cmp || !real ? ARRAY_I64 : ARRAY_F64, n);
+
+    if (real) {
+        f64 na, nb;
+        bool own_a, own_b;
+        f64* pa = f64_operand(a, x, &na, &own_a);
+        f64* pb = f64_operand(b, y, &nb, &own_b);
+
+        if (cmp) {
+            kernel_f64_cmp(op, dst->at.ints, pa, as, pb, bs, n);
+        } else {
+            kernel_f64_op(op, dst->at.reals, pa, as, pb, bs, n);
+        }
+
+        if (own_a) free(pa);
+        if (own_b) free(pb);
+    } else {
+        i64 na = value_as_int(a);
+        i64 nb = value_as_int(b);
+        i64* pa = x != NULL ? x->at.ints : &na;
+        i64* pb = y != NULL ? y->at.ints : &nb;
+
+        if (cmp) {
+            kernel_i64_cmp(op, dst->at.ints, pa, as, pb, bs, n);
+        } else {
+            kernel_i64_op(op, dst->at.ints, pa, as, pb, bs, n);
+        }
+    }
+
+    return value_alloc(VALUE_NEW(VALUE_ARRAY, dst), gc);
+}
+
+Value* array_sum(Gc* gc, Array* arr) {
+    if (arr->kind == ARRAY_I64) {
+        return value_int(kernel_i64_sum(arr->at.ints, arr->len), gc);
+    }
+    return value_real(kernel_f64_sum(arr->at.reals, arr->len), gc);
+}
+
+Value* array_min(Gc* gc, Array* arr) {
+    if (arr->len == 0) {
+        return WISP_NIL;
+    }
+
+    if (arr->kind == ARRAY_I64) {
+        return value_int(kernel_i64_extreme(arr->at.ints, arr->len, false), gc);
+    }
+    return value_real(kernel_f64_extreme(arr->at.reals, arr->len, false), gc);
+}
+
+Value* array_max(Gc* gc, Array* arr) {
+    if (arr->len == 0) {
+        return WISP_NIL;
+    }
+
+    if (arr->kind == ARRAY_I64) {
+        return value_int(kernel_i64_extreme(arr->at.ints, arr->len, true), gc);
+    }
+    return value_real(kernel_f64_extreme(arr->at.reals, arr->len, true), gc);
+}
+
+Value* array_dot(Gc* gc, Array* a, Array* b) {
+    if (a->len != b->len) {
+        return WISP_NIL;
+    }
+
+    if (a->kind == ARRAY_I64 && b->kind == ARRAY_I64) {
+        return value_int(kernel_i64_dot(a->at.ints, b->at.ints, a->len), gc);
+    }
+
+    f64 na, nb;
+    bool own_a, own_b;
+    f64* pa = f64_operand(NULL, a, &na, &own_a);
+    f64* pb = f64_operand(NULL, b, &nb, &own_b);
+    f64 dot = kernel_f64_dot(pa, pb, a->len);
+
+    if (own_a) free(pa);
+    if (own_b) free(pb);
+    return value_real(dot, gc);
+}
@@ -2,128 +2,182 @@
 #include <Pigeon/defines.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "include/ast.h"
 #include "include/env.h"
 #include "include/value.h"
 #include "include/gc.h"
+#include "include/symbol.h"
+#include "include/pool.h"
 
-AST_Vec* ast_vec_new() {
-    AST_Vec* vec = malloc(sizeof(AST_Vec));
-    vec->cap = 64;
-    vec->len = 0;
+// Makes room for need items in one of the tree's arrays
+static void* ast_grow(void* at, u32* cap, u32 need, usize size) {
+    if (need <= *cap) return at;
 
-    vec->at = malloc(vec->cap * sizeof(AST*));
-    return vec;
+    u32 new_cap = *cap == 0 ? DATA_START_CAPACITY : *cap;
+    while (new_cap < need) {
+        new_cap *= 2;
+    }
+
+    at = realloc(at, new_cap * size);
+    ASSERT(at != NULL, "outta ram");
+    *cap = new_cap;
+    return at;
 }
 
-void ast_vec_append(AST_Vec* vec, AST* item) {
-    if (vec->len >= vec->cap) {
-        vec->cap = vec->cap == 0 ? 64 : vec->cap * 2;
-        vec->at = realloc(vec->at, vec->cap * sizeof(AST*));
-        ASSERT(vec->at, "Failed to realloc list");
+AST_Tree* ast_tree_new() {
+    AST_Tree* tree = calloc(1, sizeof(AST_Tree));
+    ASSERT(tree != NULL, "outta ram");
+    return tree;
+}
+
+void ast_tree_free(AST_Tree* tree) {
+    free(tree->tags);
+    free(tree->flags);
+    free(tree->data);
+    free(tree->kids);
+    free(tree->text);
+    free(tree->fns);
+    free(tree->captures);
+    free(tree->boxes);
+    free(tree);
+}
+
+AST_Id ast_new(AST_Tree* tree, AST_Tag tag, AST_Data data) {
+    if (tree->len >= tree->cap) {
+        tree->cap = tree->cap == 0 ? DATA_START_CAPACITY : tree->cap * 2;
+        tree->tags = realloc(tree->tags, tree->cap * sizeof(u8));
+        tree->flags = realloc(tree->flags, tree->cap * sizeof(u8));
+        tree->data = realloc(tree->data, tree->cap * sizeof(AST_Data));
+        ASSERT(tree->tags != NULL && tree->flags != NULL && tree->data != NULL, "outta ram");
     }
-    vec->at[vec->len++] = item;
+
+    tree->tags[tree->len] = tag;
+    tree->flags[tree->len] = 0;
+    tree->data[tree->len] = data;
+    return tree->len++;
 }
 
-void ast_vec_free(AST_Vec* vec) {
-    for (usize i = 0; i < vec->len; ++i) {
-        ast_free(vec->at[i]);
+// Children are stored as one run, returns where it starts
+u32 ast_add_kids(AST_Tree* tree, AST_Id* kids, u32 len) {
+    tree->kids = ast_grow(tree->kids, &tree->kid_cap, tree->kid_len + len, sizeof(AST_Id));
+
+    u32 start = tree->kid_len;
+    if (len > 0) {
+        memcpy(tree->kids + start, kids, len * sizeof(AST_Id));
     }
+    tree->kid_len += len;
+    return start;
+}
 
-    free(vec->at);
-    free(vec);
+// Room for a string of len chars and its nul, only good until the
+// next string is added
+char* ast_reserve_text(AST_Tree* tree, u32 len) {
+    tree->text = ast_grow(tree->text, &tree->text_cap, tree->text_len + len + 1, sizeof(char));
+    return tree->text + tree->text_len;
 }
 
-AST* ast_new(AST ast) {
-    AST* ptr = (AST*)malloc(sizeof(AST));
-    ptr->eval = true;
-    if (ptr) *ptr = ast;
-    return ptr;
+u32 ast_add_fn(AST_Tree* tree, AST_Fn fn) {
+    tree->fns = ast_grow(tree->fns, &tree->fn_cap, tree->fn_len + 1, sizeof(AST_Fn));
+    tree->fns[tree->fn_len] = fn;
+    return tree->fn_len++;
 }
 
-void ast_print(AST* ast) {
-    if (!ast) return;
-    switch (ast->tag) {
-        case AST_PROG: {
-            struct AST_PROG data = ast->data.AST_PROG;
-            printf("(");
-            for (usize i = 0; i < data.vec->len; ++i) {
-                ast_print(data.vec->at[i]);
+u32 ast_add_captures(AST_Tree* tree, Capture* captures, u32 len) {
+    tree->captures = ast_grow(tree->captures, &tree->capture_cap, tree->capture_len + len, sizeof(Capture));
 
-                if (i + 1 < data.vec->len) {
-                    printf(" ");
-                }
-            }
-            printf(")");
-            break;
+    u32 start = tree->capture_len;
+    if (len > 0) {
+        memcpy(tree->captures + start, captures, len * sizeof(Capture));
+    }
+    tree->capture_len += len;
+    return start;
+}
+
+u32 ast_add_boxes(AST_Tree* tree, u32* boxes, u32 len) {
+    tree->boxes = ast_grow(tree->boxes, &tree->box_cap, tree->box_len + len, sizeof(u32));
+
+    u32 start = tree->box_len;
+    if (len > 0) {
+        memcpy(tree->boxes + start, boxes, len * sizeof(u32));
+    }
+    tree->box_len += len;
+    return start;
+}
+
+static void ast_print_kids(AST_Tree* tree, AST_Id* kids, u32 len) {
+    for (u32 i = 0; i < len; ++i) {
+        ast_print(tree, kids[i]);
+
+        if (i + 1 < len) {
+            printf(" ");
         }
+    }
+}
+
+void ast_print(AST_Tree* tree, AST_Id id) {
+    if (id == AST_NONE) return;
+    switch (ast_tag(tree, id)) {
+        case AST_PROG:
         case AST_LIST: {
-            struct AST_LIST data = ast->data.AST_LIST;
             printf("(");
-            for (usize i = 0; i < data.vec->len; ++i) {
-                ast_print(data.vec->at[i]);
-
-                if (i + 1 < data.vec->len) {
-                    printf(" ");
-                }
-            }
+            ast_print_kids(tree, ast_kids(tree, id), ast_len(tree, id));
             printf(")");
             break;
         }
         case AST_FN: {
-            struct AST_FN data = ast->data.AST_FN;
+            AST_Fn* fn = ast_fn(tree, id);
             printf("(fn ");
             printf("(");
-            ast_print(data.params);
+            ast_print(tree, fn->params);
             printf(") ");
 
             printf("(");
-            for (usize i = 0; i < data.body->len; ++i) {
-                ast_print(data.body->at[i]);
-
-                if (i + 1 < data.body->len) {
-                    printf(" ");
-                }
-            }
-            
+            ast_print_kids(tree, &tree->kids[fn->body], fn->body_len);
             printf(")");
             printf(")");
 
             break;
         }
         case AST_IF: {
-            struct AST_IF data = ast->data.AST_IF;
+            AST_Id* kids = ast_kids(tree, id);
             printf("(if ");
             printf("(");
-            ast_print(data.condition);
+            ast_print(tree, kids[0]);
             printf(") ");
             printf("(");
-            ast_print(data.then_branch);
+            ast_print(tree, kids[1]);
             printf(") ");
             printf("(");
-            ast_print(data.else_branch);
+            ast_print(tree, kids[2]);
             printf(") ");
             printf(")");
 
             break;
         }
+        case AST_SET: {
+            AST_Id* kids = ast_kids(tree, id);
+            printf("(set ");
+            ast_print(tree, kids[0]);
+            printf(" ");
+            ast_print(tree, kids[1]);
+            printf(")");
+            break;
+        }
         case AST_NUMBER: {
-            struct AST_NUMBER data = ast->data.AST_NUMBER;
-            printf("(INTEGER %d)", data.val);
+            printf("(INTEGER %d)", tree->data[id].number);
             break;
         }
         case AST_SYM: {
-            struct AST_SYM data = ast->data.AST_SYM;
-
             printf("(SYM ");
-            string_print(data.sym);
+            symbol_print(ast_sym(tree, id));
             printf(")");
             break;
         }
         case AST_STR: {
             printf("(STR ");
-            string_print(ast->data.AST_STR.str);
+            string_print(ast_str(tree, id));
             printf(")");
             break;
         }
@@ -134,23 +188,19 @@ void ast_print(AST* ast) {
     }
 }
 
-static Value* ast_eval_no_eval(AST* ast, Env* env, Gc* gc) {
-    switch (ast->tag) {
+static Value* ast_eval_no_eval(AST_Tree* tree, AST_Id id, Env* env, Gc* gc) {
+    switch (ast_tag(tree, id)) {
         case AST_SYM: {
-            struct AST_SYM data = ast->data.AST_SYM;
-
-            String s = string_malloc_str(data.sym.data);
-
-            Value* val = value_alloc(VALUE_NEW(VALUE_SYM, s), gc);
-            return val;
+            return ast_sym(tree, id)->value;
         }
         case AST_LIST: {
-            struct AST_LIST data = ast->data.AST_LIST;
-            Value_Vec* vec = value_vec_new();
+            AST_Id* kids = ast_kids(tree, id);
+            u32 len = ast_len(tree, id);
+            Value_Vec* vec = value_vec_new(len);
 
-            for (usize i = 0; i < data.vec->len; ++i) {
-                data.vec->at[i]->eval = false;
-                value_vec_append(vec, ast_eval(data.vec->at[i], env, gc));
+            for (u32 i = 0; i < len; ++i) {
+                tree->flags[kids[i]] |= AST_QUOTED;
+                value_vec_append(vec, ast_eval(tree, kids[i], env, gc));
             }
 
             Value* val = value_alloc(VALUE_NEW(VALUE_LIST, vec), gc);
@@ -159,95 +209,145 @@ static Value* ast_eval_no_eval(AST* ast, Env* env, Gc* gc) {
 
         case AST_STR:
         case AST_NUMBER: {
-            ast->eval = true;
-            Value* v = ast_eval(ast, env, gc);
+            tree->flags[id] &= ~AST_QUOTED;
+            Value* v = ast_eval(tree, id, env, gc);
             return v;
         }
 
         default: {
-            Value* v = value_alloc(VALUE_NEW(VALUE_NIL, 0), gc);
-            return v;
+            return WISP_NIL;
         }
     }
 }
 
-Value* ast_eval(AST* ast, Env* env, Gc* gc) {
-    if (!ast->eval) {
-        return ast_eval_no_eval(ast, env, gc);
+// Evaluates a call. With tail set, a lambda with the right number of
+// args isn't called: its callee and args are left on top of the shadow
+// stack, *tail is set and the callee is returned, so lambda_call can
+// run it in its own frame.
+static Value* ast_eval_call(AST_Tree* tree, AST_Id id, Env* env, Gc* gc, bool* tail) {
+    AST_Id* kids = ast_kids(tree, id);
+    u32 len = ast_len(tree, id);
+
+    // Treat the first symbol in a list as a function
+
+    if (len == 0) {
+        Value_Vec* vec = value_vec_new(0);
+        return value_alloc(VALUE_NEW(VALUE_LIST, vec), gc);
     }
 
-    switch (ast->tag) {
-        case AST_PROG: {
-            struct AST_PROG data = ast->data.AST_PROG;
+    // The callee and the arguments sit on the shadow stack
+    // until the call is done so a collection can see them
+    Value* sym_val = ast_eval(tree, kids[0], env, gc);
+    u64 base = gc_push_root(gc, sym_val);
+
+    union {
+        WispFunc native;
+        Lambda* lambda;
+    } func;
+    if (value_tag(sym_val) == VALUE_NATIVE) {
+        func.native = VALUE_GET(sym_val, VALUE_NATIVE);
+    }  else  if (value_tag(sym_val) == VALUE_LAMBDA){
+        func.lambda = VALUE_GET(sym_val, VALUE_LAMBDA);
+    } else {
+        ASSERT(false, "First symbol must be a function");
+    }
 
-            Value* v = value_alloc(VALUE_NEW(VALUE_NIL, 0), gc);
-            for (usize i = 0; i < data.vec->len; ++i) {
-                v = ast_eval(data.vec->at[i], env, gc);
+    for (u32 i = 1; i < len; ++i) {
+        gc_push_root(gc, ast_eval(tree, kids[i], env, gc));
+    }
 
-                if (gc->mode == INTERPRET) {
-                    gc_collect(gc, env);
-                    gc_collect(gc, env);
-                    gc_collect(gc, env);
-                }
-            }
+    gc_maybe_collect(gc, env);
 
-            return v;
-        }
+    u64 argc = len - 1;
+    Value_Vec args = {&gc->roots[base + 1], argc, argc, NULL};
+
+    // The collection may have moved the callee
+    Value* v;
+    if (value_tag(gc->roots[base]) == VALUE_NATIVE) {
+        v = func.native(gc, env, args);
+    } else if (tail != NULL && func.lambda->argc == argc) {
+        *tail = true;
+        return gc->roots[base];
+    } else {
+        v = lambda_call(func.lambda, gc, &args);
+    }
+
+    gc_pop_roots(gc, base);
+
+    return v;
+}
+
+// Like ast_eval for the last form of a lambda body, calls in tail
+// position are handed back to lambda_call through *tail
+Value* ast_eval_tail(AST_Tree* tree, AST_Id id, Env* env, Gc* gc, bool* tail) {
+    if (!ast_is_eval(tree, id)) {
+        return ast_eval_no_eval(tree, id, env, gc);
+    }
+
+    switch (ast_tag(tree, id)) {
         case AST_LIST: {
-            struct AST_LIST data = ast->data.AST_LIST;
+            return ast_eval_call(tree, id, env, gc, tail);
+        }
+        case AST_IF: {
+            AST_Id* kids = ast_kids(tree, id);
+            Value* cond = ast_eval(tree, kids[0], env, gc);
 
-            // Treat the first symbol in a list as a function
-            
-            if (data.vec->len == 0) {
-                Value_Vec* vec = value_vec_new();
-                return value_alloc(VALUE_NEW(VALUE_LIST, vec), gc);
+            if (value_tag(cond) != VALUE_NIL) {
+                return ast_eval_tail(tree, kids[1], env, gc, tail);
             }
 
-            Value* sym_val = ast_eval(data.vec->at[0], env, gc);
+            return ast_eval_tail(tree, kids[2], env, gc, tail);
+        }
+        default: {
+            return ast_eval(tree, id, env, gc);
+        }
+    }
+}
 
-            union {
-                WispFunc native;
-                Lambda* lambda;
-            } func;
-            if (sym_val->tag == VALUE_NATIVE) {
-                func.native = VALUE_GET(sym_val, VALUE_NATIVE);
-            }  else  if (sym_val->tag == VALUE_LAMBDA){
-                func.lambda = VALUE_GET(sym_val, VALUE_LAMBDA);
-            } else {
-                ASSERT(false, "First symbol must be a function");
-            }
+Value* ast_eval(AST_Tree* tree, AST_Id id, Env* env, Gc* gc) {
+    if (!ast_is_eval(tree, id)) {
+        return ast_eval_no_eval(tree, id, env, gc);
+    }
 
-            Value_Vec* vec = value_vec_new();
-            for (usize i = 1; i < data.vec->len; ++i) {
-                Value* val = ast_eval(data.vec->at[i], env, gc);
-                value_vec_append(vec, val);
-            }
+    switch (ast_tag(tree, id)) {
+        case AST_PROG: {
+            AST_Id* kids = ast_kids(tree, id);
+            u32 len = ast_len(tree, id);
 
-            Value* v;
-            if (sym_val->tag == VALUE_NATIVE) {
-                v = func.native(gc, env, *vec);
-            } else {
-                v = lambda_call(func.lambda, gc, vec);
+            Value* v = WISP_NIL;
+            for (u32 i = 0; i < len; ++i) {
+                gc_maybe_collect(gc, env);
+                v = ast_eval(tree, kids[i], env, gc);
             }
 
-            free(vec->at);
-            free(vec);
-
             return v;
         }
+        case AST_LIST: {
+            return ast_eval_call(tree, id, env, gc, NULL);
+        }
         case AST_FN: {
-            struct AST_FN data = ast->data.AST_FN;
-            struct AST_LIST params = data.params->data.AST_LIST;
-            AST* body = AST_NEW(AST_PROG, data.body);
-
-            Lambda* lambda = calloc(1, sizeof(Lambda));
-            lambda->argc = params.vec->len;
-            lambda->body = body;
-            lambda->env = env_new(env);
-            lambda->params = calloc(1, sizeof(String) * params.vec->len);
-
-            for (usize i = 0; i < lambda->argc; ++i) {
-                lambda->params[i] = string_malloc_str(params.vec->at[i]->data.AST_SYM.sym.data);
+            AST_Fn* fn = ast_fn(tree, id);
+
+            // The fn form is shared by every closure made from it,
+            // only the captures are the closure's own
+            Lambda* lambda = pool_calloc(POOL_LAMBDA);
+            tree->refs++;
+            lambda->argc = ast_len(tree, fn->params);
+            lambda->tree = tree;
+            lambda->fn = id;
+            lambda->env = env->on_stack ? env->parent : env;
+            lambda->slot_count = fn->slot_count;
+            lambda->heap_frame = fn->heap_frame;
+            lambda->boxes = fn->box_count > 0 ? &tree->boxes[fn->boxes] : NULL;
+            lambda->box_count = fn->box_count;
+
+            lambda->capture_count = fn->capture_count;
+            lambda->captures = malloc(sizeof(Value*) * fn->capture_count);
+            ASSERT(fn->capture_count == 0 || lambda->captures != NULL, "outta ram");
+
+            for (u32 i = 0; i < fn->capture_count; ++i) {
+                Capture c = tree->captures[fn->captures + i];
+                lambda->captures[i] = c.local ? env->slots[c.index] : env->captures[c.index];
             }
 
             Value* v = value_alloc(VALUE_NEW(VALUE_LAMBDA, lambda), gc);
@@ -255,174 +355,118 @@ Value* ast_eval(AST* ast, Env* env, Gc* gc) {
             return v;
         }
         case AST_IF: {
-            struct AST_IF data = ast->data.AST_IF;
-            return value_alloc(VALUE_NEW(VALUE_NIL, 0), gc);
+            AST_Id* kids = ast_kids(tree, id);
+            Value* cond = ast_eval(tree, kids[0], env, gc);
+
+            if (value_tag(cond) != VALUE_NIL) {
+                return ast_eval(tree, kids[1], env, gc);
+            }
+
+            return ast_eval(tree, kids[2], env, gc);
         }
         case AST_NUMBER: {
-            struct AST_NUMBER data = ast->data.AST_NUMBER;
-            i64 num = data.val;
+            i64 num = tree->data[id].number;
 
-            Value* v = value_alloc(VALUE_NEW(VALUE_INTEGER, num), gc);
+            Value* v = value_int(num, gc);
             return v;
         }
         case AST_SYM: {
-            struct AST_SYM data = ast->data.AST_SYM;
-
-            if (!env_parent_has(env, data.sym)) {
-                // TODO Figure out how to free all the memory
-                // when an unknown function is called and the
-                // program needs to crash
-                Value *v = value_alloc(VALUE_NEW(VALUE_NIL, 0), gc);
-                return v;
-            }
+            SymKind kind = ast_sym_kind(tree, id);
+            u32 slot = tree->data[id].sym.slot;
+
+            if (kind != SYM_DYNAMIC) {
+                Value* val;
+
+                if (kind == SYM_LOCAL) {
+                    val = env->slots[slot];
+                } else if (kind == SYM_CAPTURED) {
+                    val = env->captures[slot];
+                } else {
+                    val = env_root(env)->data[slot].val;
+                }
+
+                if (tree->flags[id] & AST_BOXED) {
+                    val = VALUE_GET(val, VALUE_BOX);
+                }
 
+                if (val != NULL) {
+                    return val;
+                }
 
-            Bucket bucket = env_get(env, data.sym);
-            Value* val = bucket.val;
+                // Only a set with a computed name can still bind it
+            }
 
-            return val;
+            // TODO Figure out how to free all the memory
+            // when an unknown function is called and the
+            // program needs to crash
+            Value* val = env_get(env, ast_sym(tree, id)).val;
+            return val ? val : WISP_NIL;
+        }
+        case AST_SET: {
+            AST_Id* kids = ast_kids(tree, id);
+            AST_Id sym = kids[0];
+            SymKind kind = ast_sym_kind(tree, sym);
+            u32 slot = tree->data[sym].sym.slot;
+            Value* val = ast_eval(tree, kids[1], env, gc);
+
+            // Setting an enclosing fn's local goes through the box
+            // the closure shares with it
+            if (kind == SYM_CAPTURED || (kind == SYM_LOCAL && (tree->flags[sym] & AST_BOXED))) {
+                Value* box = kind == SYM_CAPTURED ? env->captures[slot] : env->slots[slot];
+                box->val.VALUE_BOX.val = val;
+                gc_write_barrier_value(gc, box, val);
+            } else if (kind == SYM_LOCAL) {
+                env->slots[slot] = val;
+                gc_write_barrier(gc, env, val);
+            } else {
+                env_root(env)->data[slot].val = val;
+            }
+
+            return WISP_NIL;
         }
         case AST_STR: {
-            struct AST_STR data = ast->data.AST_STR;
+            String s = string_malloc_str(ast_str(tree, id).data);
 
-            String s = string_malloc_str(data.str.data);
-
-            Value* val = value_alloc(VALUE_NEW(VALUE_SYM, s), gc);
+            Value* val = value_alloc(VALUE_NEW(VALUE_STR, s), gc);
             return val;
         }
         case AST_NIL: {
-            Value* val = value_alloc(VALUE_NEW(VALUE_NIL, 0), gc);
-            return val;
+            return WISP_NIL;
         }
     }
 
-    Value* val = value_alloc(VALUE_NEW(VALUE_NIL, 0), gc);
-    return val;
+    return WISP_NIL;
 }
 
-void ast_free(AST* ast) {
-    if (!ast) return;
-    switch (ast->tag) {
-        case AST_PROG: {
-            struct AST_PROG data = ast->data.AST_PROG;
-            ast_vec_free(data.vec);
-            free(ast);
-            return;
-        }
-        case AST_FN: {
-            struct AST_FN data = ast->data.AST_FN;
-
-            ast_free(data.params);
-            free(ast);
-            return;
-        }
-        case AST_IF: {
-            struct AST_IF data = ast->data.AST_IF;
-
-            ast_free(data.condition);
-            ast_free(data.then_branch);
-            ast_free(data.else_branch);
-            free(ast);
-
-            return;
-        }
-        case AST_LIST: {
-            struct AST_LIST data = ast->data.AST_LIST;
-            ast_vec_free(data.vec);
-            free(ast);
-            return;
-        }
-        case AST_NUMBER: {
-            struct AST_NUMBER data = ast->data.AST_NUMBER;
-            (void)data;
-            free(ast);
-            return;
-        }
-        case AST_SYM: {
-            struct AST_SYM data = ast->data.AST_SYM;
-
-            string_free(&data.sym);
-            free(ast);
-            return;
-        }
-        case AST_STR: {
-            struct AST_STR data = ast->data.AST_STR;
+static void* ast_copy(void* at, u32 len, usize size) {
+    if (len == 0) return NULL;
 
-            string_free(&data.str);
-            free(ast);
-            return;
-        }
-        case AST_NIL: {
-            struct AST_NIL data = ast->data.AST_NIL;
-            (void)data;
-            free(ast);
-            return;
-        }
-    }
+    void* copy = malloc(len * size);
+    ASSERT(copy != NULL, "outta ram");
+    memcpy(copy, at, len * size);
+    return copy;
 }
 
-AST* ast_clone(AST* ast) {
-    switch (ast->tag) {
-        case AST_NIL:
-            return AST_NEW(AST_NIL, ast->data.AST_NIL.ptr);
-        case AST_NUMBER:
-            return AST_NEW(AST_NUMBER, ast->data.AST_NUMBER.val);
-        case AST_SYM: {
-            String copy = string_clone_malloc(ast->data.AST_SYM.sym);
-            return AST_NEW(AST_SYM, copy);
-        }
-        case AST_STR: {
-            String copy = string_clone_malloc(ast->data.AST_STR.str);
-            return AST_NEW(AST_STR, copy);
-        }
-        case AST_LIST: {
-            struct AST_LIST data = ast->data.AST_LIST;
-            AST_Vec* old_vec = data.vec; 
-            AST_Vec* new_vec = ast_vec_new();
-
-            for (usize i = 0; i < old_vec->len; ++i) {
-                AST* ast = ast_clone(old_vec->at[i]);
-                ast_vec_append(new_vec, ast);
-            }
-
-            return AST_NEW(AST_LIST, new_vec);
-        }
-
-        case AST_PROG: {
-            struct AST_PROG data = ast->data.AST_PROG;
-            AST_Vec* old_vec = data.vec; 
-            AST_Vec* new_vec = ast_vec_new();
-
-            for (usize i = 0; i < old_vec->len; ++i) {
-                AST* ast = ast_clone(old_vec->at[i]);
-                ast_vec_append(new_vec, ast);
-            }
-
-            return AST_NEW(AST_PROG, new_vec);
-        }
-
-        case AST_FN: {
-            struct AST_FN data = ast->data.AST_FN;
-            
-            AST_Vec* old_vec = data.body; 
-            AST_Vec* new_vec = ast_vec_new();
-
-            for (usize i = 0; i < old_vec->len; ++i) {
-                AST* ast = ast_clone(old_vec->at[i]);
-                ast_vec_append(new_vec, ast);
-            }
-
-            return AST_NEW(AST_FN, ast_clone(data.params), new_vec);
-        }
-        case AST_IF: {
-            struct AST_IF data = ast->data.AST_IF; 
-            return AST_NEW(AST_IF, 
-                           ast_clone(data.condition), 
-                           ast_clone(data.then_branch),
-                           ast_clone(data.else_branch));
-        }
-    }
-
-    // Let's not reach this, okay?
-    return AST_NEW(AST_NIL, 0);
+// Nothing in the tree points outside of it but symbols, and those are
+// interned, so a copy is just a copy of each array
+AST_Tree* ast_clone(AST_Tree* tree) {
+    AST_Tree* copy = ast_tree_new();
+
+    copy->tags     = ast_copy(tree->tags, tree->len, sizeof(u8));
+    copy->flags    = ast_copy(tree->flags, tree->len, sizeof(u8));
+    copy->data     = ast_copy(tree->data, tree->len, sizeof(AST_Data));
+    copy->kids     = ast_copy(tree->kids, tree->kid_len, sizeof(AST_Id));
+    copy->text     = ast_copy(tree->text, tree->text_len, sizeof(char));
+    copy->fns      = ast_copy(tree->fns, tree->fn_len, sizeof(AST_Fn));
+    copy->captures = ast_copy(tree->captures, tree->capture_len, sizeof(Capture));
+    copy->boxes    = ast_copy(tree->boxes, tree->box_len, sizeof(u32));
+
+    copy->len = copy->cap = tree->len;
+    copy->kid_len = copy->kid_cap = tree->kid_len;
+    copy->text_len = copy->text_cap = tree->text_len;
+    copy->fn_len = copy->fn_cap = tree->fn_len;
+    copy->capture_len = copy->capture_cap = tree->capture_len;
+    copy->box_len = copy->box_cap = tree->box_len;
+
+    return copy;
 }
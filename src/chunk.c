@@ -0,0 +1,231 @@
+#include "include/chunk.h"
+#include "include/gc.h"
+#include "include/symbol.h"
+#include "include/value.h"
+#include <Pigeon/defines.h>
+#include <Pigeon/string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void chunk_vec_append(Chunk_Vec* vec, Chunk* item) {
+    if (vec->len >= vec->cap) {
+        vec->cap = vec->cap == 0 ? DATA_START_CAPACITY : vec->cap * 2;
+        vec->at = realloc(vec->at, vec->cap * sizeof(Chunk*));
+        ASSERT(vec->at != NULL, "outta ram");
+    }
+    vec->at[vec->len++] = item;
+}
+
+Chunk* chunk_new() {
+    Chunk* chunk = calloc(1, sizeof(Chunk));
+    ASSERT(chunk != NULL, "outta ram");
+    chunk->top = chunk;
+    return chunk;
+}
+
+// Constants go to gc when there is one, they may have ended up in the
+// env or in some other value and the gc frees them once nothing does
+static void chunk_drop_values(Value_Vec* vec, Gc* gc) {
+    for (usize i = 0; i < vec->len; ++i) {
+        Value* val = vec->at[i];
+
+        if (gc == NULL) {
+            value_free(val);
+        } else if (value_is_heap(val) && !symbol_is_canonical(val)) {
+            gc_add_value(gc, val);
+        }
+    }
+
+    free(vec->at);
+}
+
+void chunk_release(Chunk* chunk, Gc* gc) {
+    if (!chunk) return;
+
+    chunk_drop_values(&chunk->consts, gc);
+    chunk_drop_values(&chunk->quoted, gc);
+
+    for (usize i = 0; i < chunk->protos.len; ++i) {
+        chunk_release(chunk->protos.at[i], gc);
+    }
+
+    free(chunk->protos.at);
+    free(chunk->captures);
+    free(chunk->boxes);
+    free(chunk->code);
+    free(chunk);
+}
+
+void chunk_free(Chunk* chunk) {
+    chunk_release(chunk, NULL);
+}
+
+void chunk_write(Chunk* chunk, u8 byte) {
+    if (chunk->len >= chunk->cap) {
+        chunk->cap = chunk->cap == 0 ? 64 : chunk->cap * 2;
+        chunk->code = realloc(chunk->code, chunk->cap);
+        ASSERT(chunk->code != NULL, "outta ram");
+    }
+    chunk->code[chunk->len++] = byte;
+}
+
+void chunk_write_u16(Chunk* chunk, u16 val) {
+    chunk_write(chunk, val & 0xff);
+    chunk_write(chunk, val >> 8);
+}
+
+void chunk_write_u32(Chunk* chunk, u32 val) {
+    chunk_write_u16(chunk, val & 0xffff);
+    chunk_write_u16(chunk, val >> 16);
+}
+
+void chunk_patch_u32(Chunk* chunk, usize offset, u32 val) {
+    for (usize i = 0; i < 4; ++i) {
+        chunk->code[offset + i] = (val >> (i * 8)) & 0xff;
+    }
+}
+
+u32 chunk_add_const(Chunk* chunk, Value* val) {
+    ASSERT(chunk->consts.len < UINT32_MAX, "Too many constants in one chunk");
+    value_vec_append(&chunk->consts, val);
+    return chunk->consts.len - 1;
+}
+
+u16 chunk_add_proto(Chunk* chunk, Chunk* proto) {
+    ASSERT(chunk->protos.len < UINT16_MAX, "Too many fns in one chunk");
+    chunk_vec_append(&chunk->protos, proto);
+    return chunk->protos.len - 1;
+}
+
+static u16 read_u16(u8* code) {
+    return code[0] | (code[1] << 8);
+}
+
+static u32 read_u32(u8* code) {
+    return read_u16(code) | ((u32)read_u16(code + 2) << 16);
+}
+
+static void chunk_print_indent(Chunk* chunk, usize depth) {
+    usize i = 0;
+    while (i < chunk->len) {
+        printf("%*s%04zu ", (int)depth * 4, "", i);
+
+        switch ((OpCode)chunk->code[i]) {
+            case OP_CONST: {
+                printf("OP_CONST %d (", read_u16(&chunk->code[i+1]));
+                value_print(chunk->consts.at[read_u16(&chunk->code[i+1])]);
+                printf(")\n");
+                i += 3;
+                break;
+            }
+            case OP_CONST_LONG: {
+                printf("OP_CONST_LONG %u (", read_u32(&chunk->code[i+1]));
+                value_print(chunk->consts.at[read_u32(&chunk->code[i+1])]);
+                printf(")\n");
+                i += 5;
+                break;
+            }
+            case OP_GET_VAR: {
+                printf("OP_GET_VAR ");
+                value_print(chunk->consts.at[read_u32(&chunk->code[i+1])]);
+                printf("\n");
+                i += 5;
+                break;
+            }
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+            case OP_SET_BOXED: {
+                const char* name = chunk->code[i] == OP_GET_LOCAL ? "OP_GET_LOCAL"
+                                 : chunk->code[i] == OP_SET_LOCAL ? "OP_SET_LOCAL"
+                                 : "OP_SET_BOXED";
+                printf("%s %d\n", name, read_u16(&chunk->code[i+1]));
+                i += 3;
+                break;
+            }
+            case OP_GET_LOCAL_OR: {
+                printf("OP_GET_LOCAL_OR %d ", read_u16(&chunk->code[i+1]));
+                value_print(chunk->consts.at[read_u32(&chunk->code[i+3])]);
+                printf("\n");
+                i += 7;
+                break;
+            }
+            case OP_UNBOX_OR: {
+                printf("OP_UNBOX_OR ");
+                value_print(chunk->consts.at[read_u32(&chunk->code[i+1])]);
+                printf("\n");
+                i += 5;
+                break;
+            }
+            case OP_GET_CAPTURE:
+            case OP_SET_CAPTURE: {
+                printf("%s %d\n",
+                       chunk->code[i] == OP_GET_CAPTURE ? "OP_GET_CAPTURE" : "OP_SET_CAPTURE",
+                       read_u16(&chunk->code[i+1]));
+                i += 3;
+                break;
+            }
+            case OP_GET_GLOBAL:
+            case OP_SET_GLOBAL: {
+                printf("%s %d\n",
+                       chunk->code[i] == OP_GET_GLOBAL ? "OP_GET_GLOBAL" : "OP_SET_GLOBAL",
+                       read_u16(&chunk->code[i+1]));
+                i += 3;
+                break;
+            }
+            case OP_GET_GLOBAL_LONG:
+            case OP_SET_GLOBAL_LONG: {
+                printf("%s %u\n",
+                       chunk->code[i] == OP_GET_GLOBAL_LONG ? "OP_GET_GLOBAL_LONG" : "OP_SET_GLOBAL_LONG",
+                       read_u32(&chunk->code[i+1]));
+                i += 5;
+                break;
+            }
+            case OP_CLOSURE: {
+                u16 idx = read_u16(&chunk->code[i+1]);
+                printf("OP_CLOSURE %d\n", idx);
+                chunk_print_indent(chunk->protos.at[idx], depth + 1);
+                i += 3;
+                break;
+            }
+            case OP_JUMP: {
+                printf("OP_JUMP -> %04zu\n", i + 5 + read_u32(&chunk->code[i+1]));
+                i += 5;
+                break;
+            }
+            case OP_JUMP_IF_NIL: {
+                printf("OP_JUMP_IF_NIL -> %04zu\n", i + 5 + read_u32(&chunk->code[i+1]));
+                i += 5;
+                break;
+            }
+            case OP_CALL:
+            case OP_TAIL_CALL: {
+                printf("%s %d\n",
+                       chunk->code[i] == OP_CALL ? "OP_CALL" : "OP_TAIL_CALL",
+                       chunk->code[i+1]);
+                i += 2;
+                break;
+            }
+            case OP_CALL_LONG:
+            case OP_TAIL_CALL_LONG: {
+                printf("%s %u\n",
+                       chunk->code[i] == OP_CALL_LONG ? "OP_CALL_LONG" : "OP_TAIL_CALL_LONG",
+                       read_u32(&chunk->code[i+1]));
+                i += 5;
+                break;
+            }
+            case OP_NIL:    printf("OP_NIL\n");    i++; break;
+            case OP_POP:    printf("OP_POP\n");    i++; break;
+            case OP_UNBOX:  printf("OP_UNBOX\n");  i++; break;
+            case OP_RETURN: printf("OP_RETURN\n"); i++; break;
+            default: {
+                printf("Unknown opcode %d\n", chunk->code[i]);
+                i++;
+                break;
+            }
+        }
+    }
+}
+
+void chunk_print(Chunk* chunk) {
+    chunk_print_indent(chunk, 0);
+}
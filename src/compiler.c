@@ -0,0 +1,289 @@
+#include "include/compiler.h"
+#include "include/ast.h"
+#include "include/chunk.h"
+#include "include/value.h"
+#include "include/symbol.h"
+#include <Pigeon/defines.h>
+#include <Pigeon/string.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void compile_expr(Chunk* chunk, AST_Tree* tree, AST_Id id, bool tail);
+
+// Builds the data a quoted form stands for, the same way ast_eval_no_eval does.
+// Every value made here, nested ones included, ends up owned by the chunk,
+// only the outermost one is a constant.
+static Value* compile_quote(Chunk* chunk, AST_Tree* tree, AST_Id id) {
+    Value* val;
+
+    switch (ast_tag(tree, id)) {
+        case AST_SYM: {
+            // Interned, the pool only borrows it
+            val = ast_sym(tree, id)->value;
+            break;
+        }
+        case AST_STR: {
+            String s = string_malloc_str(ast_str(tree, id).data);
+            val = value_alloc(VALUE_NEW(VALUE_STR, s), NULL);
+            break;
+        }
+        case AST_NUMBER: {
+            i64 num = tree->data[id].number;
+            val = value_int(num, NULL);
+            break;
+        }
+        case AST_LIST: {
+            AST_Id* items = ast_kids(tree, id);
+            Value_Vec* vec = value_vec_new(ast_len(tree, id));
+
+            for (u32 i = 0; i < ast_len(tree, id); ++i) {
+                Value* item = compile_quote(chunk, tree, items[i]);
+                value_vec_append(&chunk->quoted, item);
+                value_vec_append(vec, item);
+            }
+
+            val = value_alloc(VALUE_NEW(VALUE_LIST, vec), NULL);
+            break;
+        }
+        default: {
+            val = WISP_NIL;
+            break;
+        }
+    }
+
+    return val;
+}
+
+static void emit_const(Chunk* chunk, Value* val) {
+    u32 idx = chunk_add_const(chunk, val);
+
+    if (idx <= UINT16_MAX) {
+        chunk_write(chunk, OP_CONST);
+        chunk_write_u16(chunk, idx);
+    } else {
+        chunk_write(chunk, OP_CONST_LONG);
+        chunk_write_u32(chunk, idx);
+    }
+}
+
+static usize emit_jump(Chunk* chunk, OpCode op) {
+    chunk_write(chunk, op);
+    chunk_write_u32(chunk, 0);
+    return chunk->len - 4;
+}
+
+static void patch_jump(Chunk* chunk, usize offset) {
+    usize dist = chunk->len - (offset + 4);
+    ASSERT(dist <= UINT32_MAX, "Jump too far");
+    chunk_patch_u32(chunk, offset, dist);
+}
+
+// Every form leaves one value on the stack, only the last one is kept.
+// In a fn body the last form is in tail position.
+static void compile_body(Chunk* chunk, AST_Tree* tree, AST_Id* body, u32 len, bool tail) {
+    if (len == 0) {
+        chunk_write(chunk, OP_NIL);
+    }
+
+    for (u32 i = 0; i < len; ++i) {
+        compile_expr(chunk, tree, body[i], tail && i + 1 == len);
+
+        if (i + 1 < len) {
+            chunk_write(chunk, OP_POP);
+        }
+    }
+
+    chunk_write(chunk, OP_RETURN);
+}
+
+static void compile_fn(Chunk* chunk, AST_Tree* tree, AST_Id id) {
+    AST_Fn* fn = ast_fn(tree, id);
+
+    Chunk* proto = chunk_new();
+    proto->top = chunk->top;
+    proto->argc = ast_len(tree, fn->params);
+    proto->slot_count = fn->slot_count;
+    proto->heap_frame = fn->heap_frame;
+    proto->capture_count = fn->capture_count;
+    proto->captures = malloc(sizeof(Capture) * fn->capture_count);
+    memcpy(proto->captures, tree->captures + fn->captures, sizeof(Capture) * fn->capture_count);
+
+    proto->box_count = fn->box_count;
+    proto->boxes = malloc(sizeof(u32) * fn->box_count);
+    memcpy(proto->boxes, tree->boxes + fn->boxes, sizeof(u32) * fn->box_count);
+
+    compile_body(proto, tree, &tree->kids[fn->body], fn->body_len, true);
+
+    chunk_write(chunk, OP_CLOSURE);
+    chunk_write_u16(chunk, chunk_add_proto(chunk, proto));
+}
+
+static void compile_call(Chunk* chunk, AST_Tree* tree, AST_Id id, bool tail) {
+    AST_Id* kids = ast_kids(tree, id);
+    u32 len = ast_len(tree, id);
+
+    if (len == 0) {
+        Value* empty = value_alloc(VALUE_NEW(VALUE_LIST, value_vec_new(0)), NULL);
+        emit_const(chunk, empty);
+        return;
+    }
+
+    for (u32 i = 0; i < len; ++i) {
+        compile_expr(chunk, tree, kids[i], false);
+    }
+
+    if (len - 1 <= UINT8_MAX) {
+        chunk_write(chunk, tail ? OP_TAIL_CALL : OP_CALL);
+        chunk_write(chunk, len - 1);
+    } else {
+        chunk_write(chunk, tail ? OP_TAIL_CALL_LONG : OP_CALL_LONG);
+        chunk_write_u32(chunk, len - 1);
+    }
+}
+
+// The global env can outgrow a u16, frames and closures can't
+static void emit_global(Chunk* chunk, OpCode op, OpCode long_op, u32 slot) {
+    if (slot <= UINT16_MAX) {
+        chunk_write(chunk, op);
+        chunk_write_u16(chunk, slot);
+    } else {
+        chunk_write(chunk, long_op);
+        chunk_write_u32(chunk, slot);
+    }
+}
+
+static void emit_get(Chunk* chunk, AST_Tree* tree, AST_Id sym) {
+    u32 slot = tree->data[sym].sym.slot;
+
+    if (ast_sym_kind(tree, sym) == SYM_GLOBAL) {
+        emit_global(chunk, OP_GET_GLOBAL, OP_GET_GLOBAL_LONG, slot);
+        return;
+    }
+
+    ASSERT(slot <= UINT16_MAX, "Variable out of range");
+    bool boxed = tree->flags[sym] & AST_BOXED;
+    bool unbound = tree->flags[sym] & AST_UNBOUND;
+
+    if (ast_sym_kind(tree, sym) == SYM_LOCAL) {
+        chunk_write(chunk, unbound && !boxed ? OP_GET_LOCAL_OR : OP_GET_LOCAL);
+    } else {
+        chunk_write(chunk, OP_GET_CAPTURE);
+    }
+    chunk_write_u16(chunk, slot);
+
+    // A variable that may not be set yet reads what the name means
+    // outside the fn while it's empty
+    if (unbound) {
+        if (boxed) chunk_write(chunk, OP_UNBOX_OR);
+        chunk_write_u32(chunk, chunk_add_const(chunk, ast_sym(tree, sym)->value));
+    } else if (boxed) {
+        chunk_write(chunk, OP_UNBOX);
+    }
+}
+
+// A set always binds in the fn it's in, never in a capture
+static void compile_set(Chunk* chunk, AST_Tree* tree, AST_Id id) {
+    AST_Id* kids = ast_kids(tree, id);
+    AST_Id sym = kids[0];
+    u32 slot = tree->data[sym].sym.slot;
+
+    compile_expr(chunk, tree, kids[1], false);
+
+    if (ast_sym_kind(tree, sym) == SYM_GLOBAL) {
+        emit_global(chunk, OP_SET_GLOBAL, OP_SET_GLOBAL_LONG, slot);
+        chunk_write(chunk, OP_NIL);
+        return;
+    }
+
+    ASSERT(slot <= UINT16_MAX, "Variable out of range");
+
+    if (ast_sym_kind(tree, sym) == SYM_LOCAL) {
+        chunk_write(chunk, (tree->flags[sym] & AST_BOXED) ? OP_SET_BOXED : OP_SET_LOCAL);
+    } else {
+        chunk_write(chunk, OP_SET_CAPTURE);
+    }
+    chunk_write_u16(chunk, slot);
+    chunk_write(chunk, OP_NIL);
+}
+
+static void compile_if(Chunk* chunk, AST_Tree* tree, AST_Id id, bool tail) {
+    AST_Id* kids = ast_kids(tree, id);
+
+    compile_expr(chunk, tree, kids[0], false);
+    usize else_jump = emit_jump(chunk, OP_JUMP_IF_NIL);
+
+    compile_expr(chunk, tree, kids[1], tail);
+    usize end_jump = emit_jump(chunk, OP_JUMP);
+
+    patch_jump(chunk, else_jump);
+    compile_expr(chunk, tree, kids[2], tail);
+    patch_jump(chunk, end_jump);
+}
+
+static void compile_expr(Chunk* chunk, AST_Tree* tree, AST_Id id, bool tail) {
+    if (!ast_is_eval(tree, id)) {
+        emit_const(chunk, compile_quote(chunk, tree, id));
+        return;
+    }
+
+    switch (ast_tag(tree, id)) {
+        case AST_PROG: {
+            ASSERT(false, "AST_PROG can only be compiled at the top level");
+            break;
+        }
+        case AST_LIST: {
+            compile_call(chunk, tree, id, tail);
+            break;
+        }
+        case AST_FN: {
+            compile_fn(chunk, tree, id);
+            break;
+        }
+        case AST_IF: {
+            compile_if(chunk, tree, id, tail);
+            break;
+        }
+        case AST_NUMBER: {
+            i64 num = tree->data[id].number;
+            emit_const(chunk, value_int(num, NULL));
+            break;
+        }
+        case AST_SET: {
+            compile_set(chunk, tree, id);
+            break;
+        }
+        case AST_SYM: {
+            if (ast_sym_kind(tree, id) != SYM_DYNAMIC) {
+                emit_get(chunk, tree, id);
+                break;
+            }
+
+            chunk_write(chunk, OP_GET_VAR);
+            chunk_write_u32(chunk, chunk_add_const(chunk, ast_sym(tree, id)->value));
+            break;
+        }
+        case AST_STR: {
+            String s = string_malloc_str(ast_str(tree, id).data);
+            emit_const(chunk, value_alloc(VALUE_NEW(VALUE_STR, s), NULL));
+            break;
+        }
+        case AST_NIL: {
+            chunk_write(chunk, OP_NIL);
+            break;
+        }
+    }
+}
+
+Chunk* compile(AST_Tree* tree, AST_Id prog) {
+    Chunk* chunk = chunk_new();
+    compile_body(chunk, tree, ast_kids(tree, prog), ast_len(tree, prog), false);
+    return chunk;
+}
+
+// A single top level form, the chunk doesn't point into it afterwards
+Chunk* compile_form(AST_Tree* tree, AST_Id form) {
+    Chunk* chunk = chunk_new();
+    compile_expr(chunk, tree, form, false);
+    chunk_write(chunk, OP_RETURN);
+    return chunk;
+}
@@ -1,120 +1,176 @@
 #include "include/env.h"
+#include "include/pool.h"
 #include <Pigeon/string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-static u64 hash(String key) {
-    u64 hash = 0; 
-
-    for (u64 i = 0; i < key.len; ++i) {
-        // hash = (hash + (u64)*key.data+i) << i;
-        hash = (hash + (u64)*key.data+i) << (5 * i);
-        hash += key.len * i;
-    }
-
-    hash %= ENV_LEN;
-
-    return hash;
-}
-
 Env* env_new(Env* parent) {
-    Env* env = malloc(sizeof(Env));
-    env->len = ENV_LEN;
-    env->data = malloc(ENV_LEN * sizeof(Bucket));
+    Env* env = pool_alloc(POOL_ENV);
     env->parent = parent;
+    env->data = NULL;
+    env->len = 0;
+    env->cap = 0;
+    env->index = NULL;
+    env->index_cap = 0;
+    env->slots = NULL;
+    env->slot_count = 0;
+    env->captures = NULL;
+    env->on_stack = false;
+    env->marked = false;
+    env->remembered = false;
 
-    for (usize i = 0; i < ENV_LEN; ++i) {
-        env->data[i] = (Bucket) {NULL, string(""), false, 0};
-    }
+    return env;
+}
 
+Env* env_new_frame(Env* parent, u32 slot_count) {
+    Env* env = env_new(parent);
+    env->slots = calloc(slot_count, sizeof(Value*));
+    env->slot_count = slot_count;
     return env;
 }
 
 void env_free(Env* env) {
     if (env) {
+        free(env->slots);
+        free(env->index);
         free(env->data);
-        free(env);
+        pool_free(POOL_ENV, env);
     } 
 }
 
+// The global env at the end of the chain
+Env* env_root(Env* env) {
+    while (env->parent != NULL) {
+        env = env->parent;
+    }
+    return env;
+}
 
-i64 env_get_hash(Env* env, String key) {
-    u64 hash_val = hash(key); 
-    u64 first_hash = hash_val;
-    Bucket bucket = env->data[hash_val];
+static void env_grow_index(Env* env) {
+    free(env->index);
+    env->index_cap = env->index_cap == 0 ? ENV_INITIAL_CAP : env->index_cap * 2;
+    env->index = calloc(env->index_cap, sizeof(u32));
+    ASSERT(env->index != NULL, "outta ram");
+
+    u64 mask = env->index_cap - 1;
+    for (u64 i = 0; i < env->len; ++i) {
+        u64 pos = env->data[i].ident->hash & mask;
+        while (env->index[pos] != 0) {
+            pos = (pos + 1) & mask;
+        }
+        env->index[pos] = i + 1;
+    }
+}
 
-    if (bucket.occupied && string_eq(key, bucket.ident)) {
-        return hash_val;
+i64 env_get_hash(Env* env, Symbol* key) {
+    if (env->len == 0) {
+        return -1;
     }
 
-    while (!string_eq(bucket.ident, key)) {
-        hash_val = (hash_val + 1) % ENV_LEN;
+    u64 mask = env->index_cap - 1;
+    u64 pos = key->hash & mask;
 
-        if (hash_val == first_hash) {
-            // Return -1 if the hashmap doesn't have the key
-            return -1;
+    // The index is never full, so this always hits an empty spot
+    while (env->index[pos] != 0) {
+        if (env->data[env->index[pos] - 1].ident == key) {
+            return env->index[pos] - 1;
         }
 
-        bucket = env->data[hash_val];
+        pos = (pos + 1) & mask;
     }
 
-    return hash_val;
+    return -1;
 }
 
-Bucket env_get(Env* env, String key) {
-    if (env_has(env, key)) {
-        return env->data[env_get_hash(env, key)];
-    }
+// The first bucket up the chain that has a value, one with a NULL val
+// if there is none. Entries without a value only hold a slot.
+Bucket env_get(Env* env, Symbol* key) {
+    for (; env != NULL; env = env->parent) {
+        i64 index = env_get_hash(env, key);
 
-    if (env->parent == NULL) {
-        return (Bucket) {.occupied = 0};
+        if (index >= 0 && env->data[index].val != NULL) {
+            return env->data[index];
+        }
     }
-    
-    return env_get(env->parent, key);
+
+    return (Bucket) {0};
 }
 
-static bool env_insert_index(Env* env, u64 index, String key, Value* val) {
-    Bucket* bucket = &env->data[index];
-    
-    if (bucket->occupied && !string_eq(bucket->ident, key)) {
-        return false; 
+void env_insert(Env* env, Symbol* key, Value* val) {
+    i64 found = env_get_hash(env, key);
+
+    if (found >= 0) {
+        env->data[found].val = val;
+        return;
+    }
+
+    if ((env->len + 1) * 4 > env->index_cap * 3) {
+        env_grow_index(env);
+    }
+
+    if (env->len >= env->cap) {
+        env->cap = env->cap == 0 ? ENV_INITIAL_CAP : env->cap * 2;
+        env->data = realloc(env->data, env->cap * sizeof(Bucket));
+        ASSERT(env->data != NULL, "outta ram");
     }
 
-    *bucket = (Bucket){
+    env->data[env->len] = (Bucket){
         .val = val, 
         .ident = key, 
-        .occupied = true,
-        .hash = index,
     };
 
-    return true;
+    u64 mask = env->index_cap - 1;
+    u64 pos = key->hash & mask;
+    while (env->index[pos] != 0) {
+        pos = (pos + 1) & mask;
+    }
+    env->index[pos] = ++env->len;
 }
 
-void env_insert(Env* env, String key, Value* val) {
-    u64 hash_val = hash(key);
+// Returns the entry index of key, adding an entry with no value yet if
+// the key isn't bound. Entries never move, so the index can be resolved
+// once and read directly from then on.
+u64 env_slot(Env* env, Symbol* key) {
+    i64 index = env_get_hash(env, key);
 
-    while (!env_insert_index(env, hash_val, key, val)) {
-        hash_val = (hash_val + 1) % ENV_LEN;
+    if (index < 0) {
+        env_insert(env, key, NULL);
+        return env->len - 1;
     }
+
+    return index;
 }
 
-bool env_parent_has(Env* env, String key) {
-    i64 hash_val = env_get_hash(env, key);
+// Marks every value bound in env and the envs it closes over
+void env_mark(Env* env) {
+    if (env == NULL || env->marked) return;
+    env->marked = true;
 
-    if (hash_val < 0) {
-        if (env->parent == NULL) {
-            return false;
-        }
+    for (u64 i = 0; i < env->len; ++i) {
+        if (env->data[i].val) value_mark(env->data[i].val);
+    }
 
-        return env_parent_has(env->parent, key);
+    for (u32 i = 0; i < env->slot_count; ++i) {
+        if (env->slots[i]) value_mark(env->slots[i]);
     }
 
-    return true;
+    env_mark(env->parent);
 }
 
-bool env_has(Env* env, String key) {
-    i64 hash_val = env_get_hash(env, key);
-    return hash_val >= 0;
+void env_unmark(Env* env) {
+    if (env == NULL || !env->marked) return;
+    env->marked = false;
+    env->remembered = false;
+
+    for (u64 i = 0; i < env->len; ++i) {
+        if (env->data[i].val) value_unmark(env->data[i].val);
+    }
+
+    for (u32 i = 0; i < env->slot_count; ++i) {
+        if (env->slots[i]) value_unmark(env->slots[i]);
+    }
+
+    env_unmark(env->parent);
 }
 
 void env_print(Env* env) {
@@ -127,12 +183,14 @@ void env_print(Env* env) {
 }
 
 void bucket_print(Bucket b) {
-    if (!b.occupied) {
+    if (!b.val) {
         printf("Bucket: { Empty }\n");
         return;
     }
 
-    printf("Bucket: {Key: %s, Value: ", b.ident.data);
+    printf("Bucket: {Key: ");
+    symbol_print(b.ident);
+    printf(", Value: ");
     value_print(b.val);
-    printf(", hash: %d}\n", b.hash);
+    printf(", id: %u}\n", b.ident->id);
 }
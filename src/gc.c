@@ -1,25 +1,43 @@
 #include "include/gc.h"
+#include "include/array.h"
 #include "include/env.h"
 #include "include/value.h"
+#include "include/pool.h"
 #include <stdio.h>
 #include <stdlib.h>
 
 Gc* gc_new() {
-    Gc* gc = malloc(sizeof(Gc));
+    Gc* gc = calloc(1, sizeof(Gc));
     gc->at = malloc(sizeof(Value*) * GC_INITIAL_CAP);
     gc->cap = GC_INITIAL_CAP;
     gc->len = 0;
     gc->mode = AUTOMATIC;
+    gc->threshold = GC_MIN_THRESHOLD;
 
     return gc;
 }
 
 void gc_free(Gc* gc) {
+    for (usize i = 0; i < gc->owner_len; ++i) {
+        value_drop(gc->owners[i]);
+    }
+
     for (usize i = 0; i < gc->len; ++i) {
         value_free(gc->at[i]);
     }
 
+    for (usize i = 0; i < gc->env_len; ++i) {
+        env_free(gc->envs[i]);
+    }
+
+    free(gc->nursery);
+    free(gc->owners);
+    free(gc->dirty_envs);
+    free(gc->dirty);
     free(gc->at);
+    free(gc->envs);
+    free(gc->roots);
+    free(gc->scopes);
     free(gc);
 }
 
@@ -38,83 +56,399 @@ void gc_set_mode(Gc* gc, GcMode mode) {
     gc->mode = mode;
 }
 
-void gc_add_value(Gc* gc, Value* val) {
-    if (gc->len >= gc->cap) {
-        gc->cap *= 2;
-        gc->at = realloc(gc->at, gc->cap * sizeof(Value));
+// Makes room for one more item in one of the gc's arrays
+static void* gc_reserve(void* at, u64 len, u64* cap, usize size) {
+    if (len < *cap) return at;
+
+    *cap = *cap == 0 ? GC_INITIAL_CAP : *cap * 2;
+    at = realloc(at, *cap * size);
+    ASSERT(at != NULL, "outta ram");
+    return at;
+}
+
+// Rough size of everything a value owns, only used to pace collections
+static usize value_size(Value* val) {
+    usize size = sizeof(Value);
 
-        for (usize i = gc->len+1; i < gc->cap; ++i) {
-            *gc->at[i] = VALUE_NEW(VALUE_NIL, 0);
+    switch (val->tag) {
+        case VALUE_STR:
+            size += val->val.VALUE_STR.val.len;
+            break;
+        case VALUE_LIST:
+        case VALUE_VECTOR:
+        case VALUE_XFORM:
+            size += sizeof(Value_Vec) + VALUE_GET(val, VALUE_LIST)->cap * sizeof(Value*);
+            break;
+        case VALUE_LAMBDA: {
+            Lambda* lambda = VALUE_GET(val, VALUE_LAMBDA);
+            size += sizeof(Lambda) + lambda->capture_count * sizeof(Value*);
+            break;
         }
+        case VALUE_ARRAY:
+            size += sizeof(Array) + VALUE_GET(val, VALUE_ARRAY)->len * sizeof(i64);
+            break;
+        default: break;
+    }
+
+    return size;
+}
+
+static usize env_size(Env* env) {
+    return sizeof(Env) + env->slot_count * sizeof(Value*);
+}
+
+static bool value_owns_memory(Value* val) {
+    switch (val->tag) {
+        case VALUE_STR:
+        case VALUE_LIST:
+        case VALUE_VECTOR:
+        case VALUE_XFORM:
+        case VALUE_LAMBDA:
+        case VALUE_ARRAY:
+        case VALUE_ERR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool value_has_children(Value* val) {
+    return val->tag == VALUE_LIST || val->tag == VALUE_VECTOR || val->tag == VALUE_XFORM ||
+           val->tag == VALUE_LAMBDA || val->tag == VALUE_BOX ||
+           val->tag == VALUE_PROMISE || val->tag == VALUE_SEQ;
+}
+
+static bool gc_is_young(Gc* gc, Value* val) {
+    return val >= gc->nursery && val < gc->nursery + gc->nursery_cap;
+}
+
+// Old values made while the nursery is full may point at young ones
+static void gc_remember_value(Gc* gc, Value* val) {
+    gc->dirty = gc_reserve(gc->dirty, gc->dirty_len, &gc->dirty_cap, sizeof(Value*));
+    gc->dirty[gc->dirty_len++] = val;
+}
+
+Value* gc_alloc(Gc* gc, Value val) {
+    // A gc that never collects has no use for a nursery
+    if (gc->mode != OFF && gc->nursery == NULL) {
+        gc->nursery_cap = GC_NURSERY_SIZE / sizeof(Value);
+        gc->nursery = malloc(gc->nursery_cap * sizeof(Value));
+        ASSERT(gc->nursery != NULL, "outta ram");
+    }
+
+    if (gc->nursery_len < gc->nursery_cap) {
+        Value* v = &gc->nursery[gc->nursery_len++];
+        *v = val;
+
+        if (value_owns_memory(v)) {
+            gc->owners = gc_reserve(gc->owners, gc->owner_len, &gc->owner_cap, sizeof(Value*));
+            gc->owners[gc->owner_len++] = v;
+            gc->young_bytes += value_size(v) - sizeof(Value);
+        }
+
+        return v;
+    }
 
+    // Only collections at safe points can empty the nursery, until
+    // then values go straight to the old space
+    Value* v = pool_alloc(POOL_VALUE);
+    *v = val;
+
+    gc_add_value(gc, v);
+    if (gc->nursery != NULL && value_has_children(v)) {
+        gc_remember_value(gc, v);
+    }
+
+    return v;
+}
+
+void gc_add_value(Gc* gc, Value* val) {
+    if (gc->len >= gc->cap) {
+        gc->cap *= 2;
+        gc->at = realloc(gc->at, gc->cap * sizeof(Value*));
         ASSERT(gc->at, "GC failed to add new value");
     }
 
     gc->at[gc->len++] = val;
+    gc->allocated += value_size(val);
 }
 
-static int compare_value(const void* a, const void* b) {
-    i64 d = ((const Value*)b - (const Value*)a);
+// For buffers that grow after their value was made, the bytes count
+// toward whichever space the value is in
+void gc_grow(Gc* gc, Value* val, usize bytes) {
+    if (gc->nursery != NULL && gc_is_young(gc, val)) {
+        gc->young_bytes += bytes;
+    } else {
+        gc->allocated += bytes;
+    }
+}
 
-    if (d < 0) {
-        return -1;
-    } 
-    else if (d > 0) {
-        return 1;
+// Frames on the C stack are always scopes, they never need remembering
+void gc_remember_env(Gc* gc, Env* env) {
+    if (env->remembered || env->on_stack) return;
+
+    gc->dirty_envs = gc_reserve(gc->dirty_envs, gc->dirty_env_len, &gc->dirty_env_cap, sizeof(Env*));
+    gc->dirty_envs[gc->dirty_env_len++] = env;
+    env->remembered = true;
+}
+
+// Has to be called whenever a value is stored into an env that isn't
+// the one handed to the collector
+void gc_write_barrier(Gc* gc, Env* env, Value* val) {
+    if (!env->remembered && gc_is_young(gc, val)) {
+        gc_remember_env(gc, env);
     }
-    else {
-        return 0;
+}
+
+// Same for a value stored into an old box
+void gc_write_barrier_value(Gc* gc, Value* obj, Value* val) {
+    if (gc->nursery != NULL && !gc_is_young(gc, obj) && gc_is_young(gc, val)) {
+        gc_remember_value(gc, obj);
     }
 }
 
-void gc_collect(Gc* gc, Env* env) {
-    // TODO sort and defragment the array of values
+void gc_add_env(Gc* gc, Env* env) {
+    gc->envs = gc_reserve(gc->envs, gc->env_len, &gc->env_cap, sizeof(Env*));
+    gc->envs[gc->env_len++] = env;
+    gc->allocated += env_size(env);
+
+    // A new env is filled in right away, scanning it once is
+    // cheaper than a barrier on each of those stores
+    gc_remember_env(gc, env);
+}
 
-    qsort(gc->at, gc->len, sizeof(Value*), compare_value);
+void gc_set_stack(Gc* gc, Value** stack, usize* sp) {
+    gc->stack = stack;
+    gc->sp = sp;
+}
 
-    while(gc->len > 0 && gc->at[gc->len - 1]->tag == VALUE_NIL) {
-        free(gc->at[gc->len - 1]);
-        gc->len--;
+// Returns the shadow stack height before the push, hand it back to
+// gc_pop_roots to drop everything pushed since
+u64 gc_push_root(Gc* gc, Value* val) {
+    if (gc->roots == NULL) {
+        gc->roots = malloc(GC_ROOTS_MAX * sizeof(Value*));
+        ASSERT(gc->roots, "outta ram");
     }
 
-    for (usize i = 0; i < env->len; ++i) {
-        Bucket bucket = env->data[i]; 
-        if (!bucket.occupied) continue;
+    ASSERT(gc->root_len < GC_ROOTS_MAX, "Shadow stack overflow");
+
+    gc->roots[gc->root_len++] = val;
+    return gc->root_len - 1;
+}
+
+void gc_pop_roots(Gc* gc, u64 base) {
+    gc->root_len = base;
+}
 
-        value_mark(bucket.val);
+void gc_push_scope(Gc* gc, Env* env) {
+    gc->scopes = gc_reserve(gc->scopes, gc->scope_len, &gc->scope_cap, sizeof(Env*));
+    gc->scopes[gc->scope_len++] = env;
+}
+
+void gc_pop_scope(Gc* gc) {
+    gc->scope_len--;
+}
+
+// Copies a young value to the old space, once. The nursery copy is
+// marked and keeps the new address so later references follow it.
+static void gc_promote(Gc* gc, Value** slot) {
+    Value* val = *slot;
+    if (!value_is_heap(val) || !gc_is_young(gc, val)) return;
+
+    if (val->marked) {
+        *slot = val->val.forward;
+        return;
     }
 
-    for (usize i = 0; i < gc->len; ++i) {
-        if (gc->at[i]->tag == VALUE_SYM) {
-            String sym = VALUE_GET(gc->at[i], VALUE_SYM);
-            if (env_has(env, sym)) {
-                value_mark(gc->at[i]);
+    Value* copy = pool_alloc(POOL_VALUE);
+    *copy = *val;
+    gc_add_value(gc, copy);
+
+    val->marked = true;
+    val->val.forward = copy;
+    *slot = copy;
+}
+
+static void gc_promote_children(Gc* gc, Value* val) {
+    switch (val->tag) {
+        case VALUE_LIST:
+        case VALUE_VECTOR:
+        case VALUE_XFORM: {
+            Value_Vec* vec = VALUE_GET(val, VALUE_LIST);
+            if (vec->base) gc_promote(gc, &vec->base);
+
+            for (usize i = 0; i < vec->len; ++i) {
+                gc_promote(gc, &vec->at[i]);
+            }
+            return;
+        }
+        case VALUE_LAMBDA: {
+            Lambda* lambda = VALUE_GET(val, VALUE_LAMBDA);
+            for (u32 i = 0; i < lambda->capture_count; ++i) {
+                gc_promote(gc, &lambda->captures[i]);
             }
+            return;
+        }
+        case VALUE_BOX: {
+            gc_promote(gc, &val->val.VALUE_BOX.val);
+            return;
+        }
+        case VALUE_PROMISE: {
+            gc_promote(gc, &val->val.VALUE_PROMISE.val);
+            return;
+        }
+        case VALUE_SEQ: {
+            gc_promote(gc, &val->val.VALUE_SEQ.val);
+            gc_promote(gc, &val->val.VALUE_SEQ.tail);
+            return;
         }
+        default: return;
+    }
+}
 
-        if (!gc->at[i]->marked) {
-            value_free(gc->at[i]);
-            gc->at[i] = value_alloc(VALUE_NEW(VALUE_NIL, 0), NULL);
+static void gc_promote_env(Gc* gc, Env* env) {
+    for (u64 i = 0; i < env->len; ++i) {
+        if (env->data[i].val) gc_promote(gc, &env->data[i].val);
+    }
+
+    for (u32 i = 0; i < env->slot_count; ++i) {
+        if (env->slots[i]) gc_promote(gc, &env->slots[i]);
+    }
+}
+
+// Empties the nursery. Only the roots, the remembered envs and values
+// and whatever survives get looked at, dead young values cost nothing
+// unless they own memory.
+void gc_minor(Gc* gc, Env* env) {
+    if (gc->nursery_len == 0 && gc->dirty_env_len == 0 && gc->dirty_len == 0) {
+        return;
+    }
+
+    // Promoted values are appended to the old space, scanning from
+    // here on until it stops growing finds everything they reach
+    u64 scan = gc->len;
+
+    for (Env* e = env; e != NULL; e = e->parent) {
+        gc_promote_env(gc, e);
+    }
+
+    for (u64 i = 0; i < gc->scope_len; ++i) {
+        gc_promote_env(gc, gc->scopes[i]);
+    }
+
+    for (u64 i = 0; i < gc->dirty_env_len; ++i) {
+        gc_promote_env(gc, gc->dirty_envs[i]);
+        gc->dirty_envs[i]->remembered = false;
+    }
+
+    for (u64 i = 0; i < gc->dirty_len; ++i) {
+        gc_promote_children(gc, gc->dirty[i]);
+    }
+
+    for (u64 i = 0; i < gc->root_len; ++i) {
+        gc_promote(gc, &gc->roots[i]);
+    }
+
+    if (gc->stack) {
+        for (usize i = 0; i < *gc->sp; ++i) {
+            gc_promote(gc, &gc->stack[i]);
         }
     }
 
-    for (usize i = 0; i < env->len; ++i) {
-        Bucket bucket = env->data[i]; 
-        if (!bucket.occupied) continue;
+    while (scan < gc->len) {
+        gc_promote_children(gc, gc->at[scan++]);
+    }
 
-        value_unmark(bucket.val);
+    // What wasn't promoted is garbage
+    for (u64 i = 0; i < gc->owner_len; ++i) {
+        if (!gc->owners[i]->marked) {
+            value_drop(gc->owners[i]);
+        }
     }
+
+    gc->nursery_len = 0;
+    gc->owner_len = 0;
+    gc->young_bytes = 0;
+    gc->dirty_env_len = 0;
+    gc->dirty_len = 0;
 }
 
-void gc_inspect(Gc* gc) {
+static void gc_trace(Gc* gc, Env* env, bool mark) {
+    void (*visit)(Value*) = mark ? value_mark : value_unmark;
+
+    if (mark) env_mark(env); else env_unmark(env);
+
+    for (u64 i = 0; i < gc->scope_len; ++i) {
+        if (mark) env_mark(gc->scopes[i]); else env_unmark(gc->scopes[i]);
+    }
+
+    // Unbound locals are NULL
+    for (u64 i = 0; i < gc->root_len; ++i) {
+        if (gc->roots[i]) visit(gc->roots[i]);
+    }
+
+    if (gc->stack) {
+        for (usize i = 0; i < *gc->sp; ++i) {
+            if (gc->stack[i]) visit(gc->stack[i]);
+        }
+    }
+}
+
+// A full collection, the nursery is emptied first so only the old
+// space has to be marked and swept. Only safe where every live value
+// is reachable from env, the shadow stack or the vm stack.
+void gc_collect(Gc* gc, Env* env) {
+    gc_minor(gc, env);
+    gc_trace(gc, env, true);
+
+    usize live_bytes = 0;
+
+    // Survivors slide down so the arrays never hold dead slots
+    usize live = 0;
     for (usize i = 0; i < gc->len; ++i) {
-        Value* v = gc->at[i];
-        if (v->tag == VALUE_NIL) {
-            printf(".");
+        if (!gc->at[i]->marked) {
+            value_free(gc->at[i]);
+        } else {
+            live_bytes += value_size(gc->at[i]);
+            gc->at[live++] = gc->at[i];
+        }
+    }
+    gc->len = live;
+
+    live = 0;
+    for (usize i = 0; i < gc->env_len; ++i) {
+        if (!gc->envs[i]->marked) {
+            env_free(gc->envs[i]);
         } else {
-            printf("+");
+            live_bytes += env_size(gc->envs[i]);
+            gc->envs[live++] = gc->envs[i];
         }
     }
-    printf("\n");
+    gc->env_len = live;
+
+    gc_trace(gc, env, false);
+
+    gc->allocated = 0;
+    gc->threshold = live_bytes > GC_MIN_THRESHOLD ? live_bytes : GC_MIN_THRESHOLD;
 }
 
+// Minor collections run once half the nursery is used so natives
+// called before the next safe point still have room, or once the
+// young values own as many bytes as the nursery holds. Whatever they
+// own is part of the heap as far as a full collection is concerned.
+void gc_maybe_collect(Gc* gc, Env* env) {
+    if (gc->mode == OFF) return;
+
+    if (gc->allocated + gc->young_bytes >= gc->threshold) {
+        gc_collect(gc, env);
+    } else if (gc->nursery != NULL &&
+               (gc->nursery_len * 2 >= gc->nursery_cap || gc->young_bytes >= GC_NURSERY_SIZE)) {
+        gc_minor(gc, env);
+    }
+}
+
+void gc_inspect(Gc* gc) {
+    printf("%lu young, %lu old, %lu envs, %zu/%zu bytes\n",
+           gc->nursery_len, gc->len, gc->env_len, gc->allocated, gc->threshold);
+    pool_print_stats();
+}
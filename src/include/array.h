@@ -0,0 +1,50 @@
+#ifndef __ARRAY_H
+#define __ARRAY_H
+
+#include <Pigeon/defines.h>
+#include "value.h"
+
+typedef enum {
+    ARRAY_I64,
+    ARRAY_F64,
+} ArrayKind;
+
+// Numbers packed back to back instead of a Value each, so the kernels
+// in array.c can go through them a simd register at a time
+struct array_t {
+    ArrayKind kind;
+    u64 len;
+
+    union {
+        i64* ints;
+        f64* reals;
+    } at;
+};
+
+// Comparisons give an i64 array of 1s and 0s. Division always gives
+// f64s, same as / on numbers.
+typedef enum {
+    ARRAY_ADD,
+    ARRAY_SUB,
+    ARRAY_MUL,
+    ARRAY_DIV,
+    ARRAY_EQ,
+    ARRAY_NEQ,
+    ARRAY_LT,
+    ARRAY_LTE,
+    ARRAY_GT,
+    ARRAY_GTE,
+} ArrayOp;
+
+Array* array_new(ArrayKind kind, u64 len);
+void   array_free(Array* arr);
+Value* array_item(Array* arr, u64 i, Gc* gc);
+Value* array_pack(Gc* gc, ArrayKind kind, Value_Vec nums);
+Value* array_from(Gc* gc, Env* env, ArrayKind kind, Value* seq);
+Value* array_binary(Gc* gc, ArrayOp op, Value* a, Value* b);
+Value* array_sum(Gc* gc, Array* arr);
+Value* array_min(Gc* gc, Array* arr);
+Value* array_max(Gc* gc, Array* arr);
+Value* array_dot(Gc* gc, Array* a, Array* b);
+
+#endif  //__ARRAY_H
@@ -2,69 +2,153 @@
 #define __AST_H
 
 #include <Pigeon/defines.h>
-#include <Pigeon/arena.h>
 #include <Pigeon/string.h>
 #include "value.h"
-
-#define AST_NEW(tag, ...) \
-    ast_new((AST){tag, {.tag=(struct tag){__VA_ARGS__}}, true}) 
-
-typedef struct AST AST;
-
-typedef struct ast_vec_t {
-    AST** at;
-    usize len; 
-    usize cap; 
-} AST_Vec;
-AST_Vec* ast_vec_new();
-void ast_vec_append(AST_Vec* vec, AST* item);
-void ast_vec_free(AST_Vec* vec);
-
-struct AST {
-    enum {
-        AST_NIL,
-        AST_PROG,
-        AST_LIST,
-        AST_NUMBER,
-        AST_SYM,
-        AST_STR,
-        AST_FN,
-        AST_IF,
-    } tag;
-
-    union {
-        struct AST_NIL
-        { void* ptr; } AST_NIL;
-
-        struct AST_PROG
-        { AST_Vec* vec; } AST_PROG;
-
-        struct AST_LIST
-        { AST_Vec* vec; } AST_LIST;
-
-        struct AST_NUMBER
-        { i32 val; } AST_NUMBER;
-
-        struct AST_SYM
-        { String sym; } AST_SYM;
-
-        struct AST_STR
-        { String str; } AST_STR;
-
-        struct AST_FN
-        { AST* params; AST_Vec* body; } AST_FN;
-
-        struct AST_IF
-        { AST* condition; AST* then_branch; AST* else_branch; } AST_IF;
-    } data;
-
-    bool eval;
-};
-
-AST* ast_new(AST ast);
-AST* ast_clone(AST* ast);
-void ast_print(AST* ast);
-Value* ast_eval(AST* ast, Env* env, Gc* gc);
-void ast_free(AST* ast);
+#include "symbol.h"
+
+// Nodes are indices into the tree they were parsed into
+typedef u32 AST_Id;
+#define AST_NONE UINT32_MAX
+
+typedef enum {
+    SYM_DYNAMIC,
+    SYM_LOCAL,
+    SYM_CAPTURED,
+    SYM_GLOBAL,
+} SymKind;
+
+typedef enum {
+    AST_NIL,
+    AST_PROG,
+    AST_LIST,
+    AST_NUMBER,
+    AST_SYM,
+    AST_STR,
+    AST_FN,
+    AST_IF,
+    AST_SET,
+} AST_Tag;
+
+// A quoted node isn't evaluated. The resolver fills in boxed and the
+// kind of a symbol, boxed locals and captures hold a VALUE_BOX with
+// the value in it. An unbound local is only set on some paths to the
+// read, its slot is NULL on the others.
+#define AST_QUOTED     (1 << 0)
+#define AST_BOXED      (1 << 1)
+#define AST_KIND_SHIFT 2
+#define AST_UNBOUND    (1 << 4)
+
+// Eight bytes of payload per node. Lists and progs are a run of
+// children in kids, so are (if cond then else) and (set 'sym val).
+// A symbol's slot indexes the frame's slots for locals, the closure's
+// captures for captured ones and the global env's buckets for globals.
+typedef union ast_data_t {
+    struct { u32 start; u32 len; } kids;
+    struct { u32 start; u32 len; } str;
+    struct { u32 id; u32 slot; } sym;
+    i32 number;
+    u32 fn;
+} AST_Data;
+
+// heap_frame is set by the resolver when the body calls set with a
+// computed name, which binds into the frame's env. captures says where
+// each captured variable comes from, boxes lists the slots that get
+// boxed on entry. Both index the tree's arrays of them.
+typedef struct ast_fn_t {
+    AST_Id params;
+    u32 body;
+    u32 body_len;
+
+    u32 slot_count;
+    bool heap_frame;
+
+    u32 captures;
+    u32 capture_count;
+    u32 boxes;
+    u32 box_count;
+} AST_Fn;
+
+// Everything one parse made. Nodes live in parallel arrays and point at
+// each other by index, so there are no pointers inside the tree and it
+// can be copied or freed as a handful of flat arrays.
+typedef struct ast_tree_t {
+    u8* tags;
+    u8* flags;
+    AST_Data* data;
+    u32 len;
+    u32 cap;
+
+    AST_Id* kids;
+    u32 kid_len;
+    u32 kid_cap;
+
+    // String literals, nul terminated
+    char* text;
+    u32 text_len;
+    u32 text_cap;
+
+    AST_Fn* fns;
+    u32 fn_len;
+    u32 fn_cap;
+
+    Capture* captures;
+    u32 capture_len;
+    u32 capture_cap;
+
+    u32* boxes;
+    u32 box_len;
+    u32 box_cap;
+
+    // One per tree walker closure made from a fn in it, they point
+    // into the tree so it can't be freed while there are any
+    u64 refs;
+} AST_Tree;
+
+AST_Tree* ast_tree_new();
+void      ast_tree_free(AST_Tree* tree);
+AST_Id    ast_new(AST_Tree* tree, AST_Tag tag, AST_Data data);
+u32       ast_add_kids(AST_Tree* tree, AST_Id* kids, u32 len);
+char*     ast_reserve_text(AST_Tree* tree, u32 len);
+u32       ast_add_fn(AST_Tree* tree, AST_Fn fn);
+u32       ast_add_captures(AST_Tree* tree, Capture* captures, u32 len);
+u32       ast_add_boxes(AST_Tree* tree, u32* boxes, u32 len);
+
+static inline AST_Tag ast_tag(AST_Tree* tree, AST_Id id) {
+    return tree->tags[id];
+}
+
+static inline bool ast_is_eval(AST_Tree* tree, AST_Id id) {
+    return !(tree->flags[id] & AST_QUOTED);
+}
+
+static inline AST_Id* ast_kids(AST_Tree* tree, AST_Id id) {
+    return &tree->kids[tree->data[id].kids.start];
+}
+
+static inline u32 ast_len(AST_Tree* tree, AST_Id id) {
+    return tree->data[id].kids.len;
+}
+
+static inline Symbol* ast_sym(AST_Tree* tree, AST_Id id) {
+    return symbol_get(tree->data[id].sym.id);
+}
+
+static inline SymKind ast_sym_kind(AST_Tree* tree, AST_Id id) {
+    return (tree->flags[id] >> AST_KIND_SHIFT) & 3;
+}
+
+static inline String ast_str(AST_Tree* tree, AST_Id id) {
+    AST_Data data = tree->data[id];
+    return (String){tree->text + data.str.start, data.str.len};
+}
+
+static inline AST_Fn* ast_fn(AST_Tree* tree, AST_Id id) {
+    return &tree->fns[tree->data[id].fn];
+}
+
+AST_Tree* ast_clone(AST_Tree* tree);
+void      ast_print(AST_Tree* tree, AST_Id id);
+Value*    ast_eval(AST_Tree* tree, AST_Id id, Env* env, Gc* gc);
+Value*    ast_eval_tail(AST_Tree* tree, AST_Id id, Env* env, Gc* gc, bool* tail);
 
 #endif  //__AST_H
@@ -0,0 +1,88 @@
+#ifndef __CHUNK_H
+#define __CHUNK_H
+
+#include <Pigeon/defines.h>
+#include <Pigeon/string.h>
+#include "value.h"
+
+// Operands follow the opcode byte, little endian. The _LONG ops are
+// the same as the short ones with a wider operand.
+typedef enum {
+    OP_CONST,           // u16 const index
+    OP_CONST_LONG,      // u32 const index
+    OP_NIL,
+    OP_GET_VAR,         // u32 const index of a VALUE_SYM
+    OP_GET_LOCAL,       // u16 slot
+    OP_GET_LOCAL_OR,    // u16 slot, u32 const index of a VALUE_SYM looked up while the slot is unbound
+    OP_SET_LOCAL,       // u16 slot, pops the value
+    OP_SET_BOXED,       // u16 slot, pops the value into the slot's box
+    OP_GET_CAPTURE,     // u16 capture index
+    OP_SET_CAPTURE,     // u16 capture index, pops the value into its box
+    OP_UNBOX,           // replaces the box on top with what's in it
+    OP_UNBOX_OR,        // u32 const index of a VALUE_SYM looked up while the box is empty
+    OP_GET_GLOBAL,      // u16 bucket index in the global env
+    OP_SET_GLOBAL,      // u16 bucket index, pops the value
+    OP_GET_GLOBAL_LONG, // u32 bucket index
+    OP_SET_GLOBAL_LONG, // u32 bucket index, pops the value
+    OP_POP,
+    OP_CALL,            // u8 argc
+    OP_CALL_LONG,       // u32 argc
+    OP_TAIL_CALL,       // u8 argc, reuses the caller's frame for a lambda
+    OP_TAIL_CALL_LONG,  // u32 argc
+    OP_CLOSURE,         // u16 proto index
+    OP_JUMP,            // u32 forward offset
+    OP_JUMP_IF_NIL,     // u32 forward offset, pops the condition
+    OP_RETURN,
+} OpCode;
+
+typedef struct chunk_vec_t {
+    Chunk** at;
+    usize len;
+    usize cap;
+} Chunk_Vec;
+void chunk_vec_append(Chunk_Vec* vec, Chunk* item);
+
+struct Chunk {
+    u8* code;
+    usize len;
+    usize cap;
+
+    // Every value in the pool is owned by the chunk and is only
+    // handed to the Gc once the chunk is released. So are the elements
+    // of quoted lists, they aren't loaded on their own so they don't
+    // take up an index.
+    Value_Vec consts;
+    Value_Vec quoted;
+
+    // The top level chunk this one was compiled in, itself for a top
+    // level one. Only the top's refs count, one per closure made from
+    // any fn in it.
+    Chunk* top;
+    u64 refs;
+
+    // Compiled bodies of the fn forms inside this chunk
+    Chunk_Vec protos;
+
+    u32 argc;
+    u32 slot_count;
+    bool heap_frame;
+
+    // Copied from the fn form, see Lambda
+    Capture* captures;
+    u32 capture_count;
+    u32* boxes;
+    u32 box_count;
+};
+
+Chunk* chunk_new();
+void   chunk_free(Chunk* chunk);
+void   chunk_release(Chunk* chunk, Gc* gc);
+void   chunk_write(Chunk* chunk, u8 byte);
+void   chunk_write_u16(Chunk* chunk, u16 val);
+void   chunk_write_u32(Chunk* chunk, u32 val);
+void   chunk_patch_u32(Chunk* chunk, usize offset, u32 val);
+u32    chunk_add_const(Chunk* chunk, Value* val);
+u16    chunk_add_proto(Chunk* chunk, Chunk* proto);
+void   chunk_print(Chunk* chunk);
+
+#endif  //__CHUNK_H
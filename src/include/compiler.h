@@ -0,0 +1,12 @@
+#ifndef __COMPILER_H
+#define __COMPILER_H
+
+#include "ast.h"
+#include "chunk.h"
+
+// Lowers an AST_PROG into a chunk that the vm can run.
+// The ast is not consumed and can be freed right after.
+Chunk* compile(AST_Tree* tree, AST_Id prog);
+Chunk* compile_form(AST_Tree* tree, AST_Id form);
+
+#endif  //__COMPILER_H
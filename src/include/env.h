@@ -2,29 +2,54 @@
 #define __ENV_H
 
 #include "value.h"
+#include "symbol.h"
 #include <Pigeon/string.h>
 
-#define ENV_LEN 3000
+#define ENV_INITIAL_CAP 8
 
 typedef struct bucket_t {
     Value*  val;
-    String  ident;
-    bool    occupied;
-    u32     hash;
+    Symbol* ident;
 } Bucket;
 
 struct Env {
     Env* parent;
+
+    // Entries in insertion order. An entry never moves once added,
+    // so its index can be used as a slot for the key
     Bucket* data;
     u64 len;
+    u64 cap;
+
+    // Open addressed table of entry index + 1, 0 marks an empty spot.
+    // Its capacity is a power of two and grows past 3/4 full
+    u32* index;
+    u64 index_cap;
+
+    // Lexically addressed params and locals of a fn scope, and the
+    // captures of the closure running in it
+    Value** slots;
+    u32 slot_count;
+    Value** captures;
+
+    // A frame on the C stack, closures made in it use its parent
+    bool on_stack;
+
+    bool marked;
+
+    // Already in its gc's list of envs to scan on a minor collection
+    bool remembered;
 };
 
 Env*     env_new(Env* parent);
+Env*     env_new_frame(Env* parent, u32 slot_count);
 void     env_free(Env* env);
-Bucket   env_get(Env* env, String key);
-void     env_insert(Env* env, String key, Value* val);
-bool     env_parent_has(Env* env, String key);
-bool     env_has(Env* env, String key);
+Env*     env_root(Env* env);
+Bucket   env_get(Env* env, Symbol* key);
+void     env_insert(Env* env, Symbol* key, Value* val);
+u64      env_slot(Env* env, Symbol* key);
+void     env_mark(Env* env);
+void     env_unmark(Env* env);
 void     bucket_print(Bucket bucket);
 
 #endif  //__ENV_H
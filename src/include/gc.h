@@ -4,6 +4,18 @@
 #include "value.h"
 
 #define GC_INITIAL_CAP 4
+#define GC_ROOTS_MAX   (1 << 16)
+
+// Bytes that have to be allocated before the first collection. After
+// that the next one runs once the heap has doubled since the last one.
+#ifndef GC_MIN_THRESHOLD
+#define GC_MIN_THRESHOLD (1 << 20)
+#endif
+
+// New values are bump allocated here, sized to sit in L2
+#ifndef GC_NURSERY_SIZE
+#define GC_NURSERY_SIZE (256 * 1024)
+#endif
 
 typedef enum {
     AUTOMATIC,
@@ -14,17 +26,82 @@ typedef enum {
 
 struct Gc {
     GcMode mode;
+
+    // Old space, every promoted value and closure env the gc owns
     Value** at;
     u64 len;
     u64 cap;
+
+    Env** envs;
+    u64 env_len;
+    u64 env_cap;
+
+    // Shadow stack of temporaries that only live on the C stack, the
+    // tree walker keeps callees, arguments and call frames here. It
+    // never moves, so pointers into it stay good until they're popped.
+    Value** roots;
+    u64 root_len;
+
+    // Heap frames of the calls in progress, nothing else points at them
+    Env** scopes;
+    u64 scope_len;
+    u64 scope_cap;
+
+    // The vm stack, registered once with gc_set_stack
+    Value** stack;
+    usize* sp;
+
+    // Set when there is one, natives that call a compiled lambda
+    // run it there
+    struct vm_t* vm;
+
+    usize allocated;
+    usize threshold;
+
+    // Young space. Values that own memory are also listed in
+    // owners, so a minor collection can free the dead ones
+    // without walking the whole nursery
+    Value* nursery;
+    u64 nursery_len;
+    u64 nursery_cap;
+
+    Value** owners;
+    u64 owner_len;
+    u64 owner_cap;
+
+    // What the owners own, a few big buffers fill the nursery as
+    // surely as lots of small values do
+    usize young_bytes;
+
+    // Old envs and values that may point into the nursery
+    Env** dirty_envs;
+    u64 dirty_env_len;
+    u64 dirty_env_cap;
+
+    Value** dirty;
+    u64 dirty_len;
+    u64 dirty_cap;
 };
 
 Gc* gc_new();
 void gc_free(Gc* gc);
 const char* gc_get_mode(Gc* gc);
 void gc_set_mode(Gc* gc, GcMode mode);
+Value* gc_alloc(Gc* gc, Value val);
 void gc_add_value(Gc* gc, Value* val);
+void gc_add_env(Gc* gc, Env* env);
+void gc_grow(Gc* gc, Value* val, usize bytes);
+void gc_remember_env(Gc* gc, Env* env);
+void gc_write_barrier(Gc* gc, Env* env, Value* val);
+void gc_write_barrier_value(Gc* gc, Value* obj, Value* val);
+void gc_set_stack(Gc* gc, Value** stack, usize* sp);
+u64  gc_push_root(Gc* gc, Value* val);
+void gc_pop_roots(Gc* gc, u64 base);
+void gc_push_scope(Gc* gc, Env* env);
+void gc_pop_scope(Gc* gc);
+void gc_minor(Gc* gc, Env* env);
 void gc_collect(Gc* gc, Env* env);
+void gc_maybe_collect(Gc* gc, Env* env);
 void gc_inspect(Gc* gc);
 
 #endif  //__GC_H
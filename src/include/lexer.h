@@ -23,9 +23,13 @@ typedef enum {
     TokenTypeCount,
 } TokenType;
 
+// lexeme points into the lexer's source, nothing is copied. For a
+// string literal it's what's between the quotes, escapes and all,
+// escaped says if there are any.
 typedef struct token_t {
     TokenType type;
     String lexeme;
+    bool escaped;
 
     u32 line;
     u32 col;
@@ -45,6 +49,7 @@ Token token_new(TokenType type, String lexeme, u32 line, u32 col);
 void token_print(Token t);
 void token_loc_print(Token t);
 String token_type_str(TokenType type);
+usize token_unescape(Token t, char* buf);
 
 Lexer* lexer_new(Arena* a, String src);
 
@@ -7,16 +7,26 @@
 
 typedef struct parser_t {
     Lexer* lexer;
-    AST* ast;
+    AST_Id ast;
     Arena* arena;
 
+    // Where the ast goes, a fresh one for every detach
+    AST_Tree* tree;
+
+    // Children of the lists being parsed
+    AST_Id* stack;
+    usize stack_len;
+    usize stack_cap;
+
     Token prev;
     Token curr;
     Token next;
 } Parser;
 
-Parser* parser_new(Arena* arena, Lexer* lexer);
-void    parser_set_src(Parser* parser, String src);
-void    parser_parse(Parser* parser);
+Parser*   parser_new(Arena* arena, Lexer* lexer);
+void      parser_set_src(Parser* parser, String src);
+void      parser_parse(Parser* parser);
+AST_Id    parser_next_form(Parser* parser);
+AST_Tree* parser_detach(Parser* parser);
 
 #endif  //__PARSER_H
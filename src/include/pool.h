@@ -0,0 +1,34 @@
+#ifndef __POOL_H
+#define __POOL_H
+
+#include <Pigeon/defines.h>
+
+// Fixed size objects come out of per type slabs instead of malloc.
+// Each class keeps its own free list, so frees are O(1) and objects
+// allocated together end up next to each other.
+#define POOL_SLAB_SIZE (64 * 1024)
+
+typedef enum {
+    POOL_VALUE,
+    POOL_VALUE_VEC,
+    POOL_LAMBDA,
+    POOL_ENV,
+    POOL_ARRAY,
+    POOL_COUNT,
+} PoolClass;
+
+typedef struct pool_stats_t {
+    u64 live;
+    u64 peak;
+    u64 slabs;
+} PoolStats;
+
+void*       pool_alloc(PoolClass cls);
+void*       pool_calloc(PoolClass cls);
+void        pool_free(PoolClass cls, void* ptr);
+PoolStats   pool_stats(PoolClass cls);
+const char* pool_class_name(PoolClass cls);
+void        pool_print_stats();
+void        pool_release_all();
+
+#endif  //__POOL_H
@@ -0,0 +1,14 @@
+#ifndef __RESOLVER_H
+#define __RESOLVER_H
+
+#include "ast.h"
+#include "env.h"
+
+// Walks a parsed program and gives every symbol its address. Params and
+// locals set inside a fn become slots of that fn's frame, locals of enclosing
+// fns become captures of the closure, the rest become buckets in globals,
+// which are claimed up front if they don't exist.
+// Literal (set 'sym val) forms are rewritten into AST_SET.
+void resolve(AST_Tree* tree, AST_Id prog, Env* globals);
+
+#endif  //__RESOLVER_H
@@ -0,0 +1,18 @@
+#ifndef __SOURCE_H
+#define __SOURCE_H
+
+#include <Pigeon/defines.h>
+#include <Pigeon/string.h>
+
+// A script's text. Regular files are mapped read only, so big scripts
+// start lexing right away and processes running the same script share
+// its pages. The text isn't NUL terminated, use its len.
+typedef struct source_t {
+    String text;
+    bool mapped;
+} Source;
+
+Source source_open(String path);
+void   source_close(Source* src);
+
+#endif  //__SOURCE_H
@@ -0,0 +1,29 @@
+#ifndef __SYMBOL_H
+#define __SYMBOL_H
+
+#include <Pigeon/defines.h>
+#include <Pigeon/string.h>
+#include "value.h"
+
+#define SYMBOL_INITIAL_CAP 256
+
+// Every distinct name is interned once for the whole process, so two
+// symbols are the same exactly when their pointers are equal
+struct Symbol {
+    String name;
+    u64 hash;
+    u32 id;
+
+    // The one VALUE_SYM for this symbol, it belongs to the symbol
+    // table and is never handed to the Gc
+    Value* value;
+};
+
+u64     string_hash(String str);
+Symbol* symbol_intern(String name);
+Symbol* symbol_get(u32 id);
+bool    symbol_is_canonical(Value* val);
+void    symbol_print(Symbol* sym);
+void    symbol_table_free();
+
+#endif  //__SYMBOL_H
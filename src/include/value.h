@@ -3,6 +3,8 @@
 
 #include <Pigeon/defines.h>
 #include <Pigeon/string.h>
+#include <stdint.h>
+#include <string.h>
 
 #define VALUE_NEW(tag, ...) \
     (Value){tag, {.tag=(struct tag){__VA_ARGS__}}, .marked = false}
@@ -10,31 +12,90 @@
 #define VALUE_GET(V, tag) ((V)->val.tag.val)
 
 typedef struct Value Value;
-typedef struct AST AST;
+typedef struct ast_tree_t AST_Tree;
 typedef struct Value_Vec Value_Vec;
 typedef struct Env Env;
 typedef struct Gc Gc;
 typedef struct Lambda Lambda;
 typedef struct Err Err;
+typedef struct Chunk Chunk;
+typedef struct Symbol Symbol;
+typedef struct array_t Array;
 
 typedef Value*(*WispFunc)(Gc* gc, Env* env, Value_Vec args);
 
+// Lists don't change once they're made. A slice, what cdr hands out,
+// has at pointing into the items of base, the list that owns them,
+// which it keeps alive. Its cap is 0, appending to it copies first.
 struct Value_Vec {
     Value** at;
     u64    len;
     u64    cap;
+    Value* base;
 };
-Value_Vec* value_vec_new();
+Value_Vec* value_vec_new(usize cap);
+Value_Vec* value_vec_slice(Value* list, usize start);
 void value_vec_free(Value_Vec* vec);
 void value_vec_append(Value_Vec* vec, Value* item);
 
+// start, start + step, ... up to but not including end. Nothing is
+// made until something walks it.
+typedef struct range_t {
+    i64 start;
+    i64 end;
+    i64 step;
+} Range;
+
+static inline u64 range_len(Range r) {
+    if (r.step > 0 && r.end > r.start) {
+        return (r.end - r.start + r.step - 1) / r.step;
+    }
+    if (r.step < 0 && r.end < r.start) {
+        return (r.start - r.end - r.step - 1) / -r.step;
+    }
+    return 0;
+}
+
+// The stages of a VALUE_XFORM, stored as fixnums
+typedef enum {
+    XFORM_MAP,
+    XFORM_FILTER,
+    XFORM_TAKE,
+} XformKind;
+
+// Where a closure gets one of its captures from when it's made, a slot
+// of the enclosing fn's frame or one of the enclosing closure's captures
+typedef struct capture_t {
+    bool local;
+    u32 index;
+} Capture;
+
+// The code is the AST_FN node in tree the closure was made from, or its
+// compiled proto for the vm. Both are immutable once resolved and
+// outlive every closure made from them, so closures only borrow them
+// and the rest of the fields are copied from there.
+//
+// Each call gets its own frame of slot_count slots. The locals of
+// enclosing fns the body uses are copied into captures when the
+// closure is made, the ones that can still change are shared through
+// a VALUE_BOX, so are the slots listed in boxes. env is only there
+// for names bound by a set with a computed name.
 struct Lambda {
     Env* env;
-    AST* body;
-    String* params;
+    AST_Tree* tree;
+    u32 fn;
+    Chunk* chunk;
     u32 argc;
+    u32 slot_count;
+    bool heap_frame;
+
+    Value** captures;
+    u32 capture_count;
+
+    u32* boxes;
+    u32 box_count;
 };
-Value* lambda_call(Lambda* lambda, Gc* parent_gc, Value_Vec* args);
+Value* lambda_call(Lambda* lambda, Gc* gc, Value_Vec* args);
 
 struct Err {
     enum {
@@ -45,18 +106,27 @@ struct Err {
     String msg; 
 };
 
+typedef enum {
+    VALUE_INTEGER,
+    VALUE_REAL,
+    VALUE_STR,
+    VALUE_SYM,
+    VALUE_NATIVE,
+    VALUE_LIST,
+    VALUE_VECTOR,
+    VALUE_XFORM,
+    VALUE_LAMBDA,
+    VALUE_NIL,
+    VALUE_ERR,
+    VALUE_BOX,
+    VALUE_RANGE,
+    VALUE_PROMISE,
+    VALUE_SEQ,
+    VALUE_ARRAY,
+} ValueTag;
+
 struct Value {
-    enum {
-        VALUE_INTEGER,
-        VALUE_REAL,
-        VALUE_STR,
-        VALUE_SYM,
-        VALUE_NATIVE,
-        VALUE_LIST,
-        VALUE_LAMBDA,
-        VALUE_NIL,
-        VALUE_ERR,
-    } tag;
+    ValueTag tag;
 
     union {
         struct VALUE_INTEGER
@@ -69,10 +139,20 @@ struct Value {
         { String val; } VALUE_STR;
         
         struct VALUE_SYM
-        { String val; } VALUE_SYM;
+        { Symbol* val; } VALUE_SYM;
 
         struct VALUE_LIST
         { Value_Vec* val; } VALUE_LIST;
+
+        // Unlike a list it can change after it's made, it's never a
+        // slice. Laid out like VALUE_LIST so the gc can treat both alike
+        struct VALUE_VECTOR
+        { Value_Vec* val; } VALUE_VECTOR;
+
+        // A pipeline of stages, a kind and its fn or count for each,
+        // run in one pass by transduce. Laid out like VALUE_LIST too.
+        struct VALUE_XFORM
+        { Value_Vec* val; } VALUE_XFORM;
         
         struct VALUE_NATIVE
         { WispFunc val; } VALUE_NATIVE;
@@ -85,16 +165,124 @@ struct Value {
 
         struct VALUE_ERR
         { Err val; } VALUE_ERR;
+
+        // A captured local that's set after the closure is made,
+        // never seen by wisp code
+        struct VALUE_BOX
+        { Value* val; } VALUE_BOX;
+
+        struct VALUE_RANGE
+        { Range val; } VALUE_RANGE;
+
+        // Holds the thunk until it's forced, then the value it gave
+        struct VALUE_PROMISE
+        { Value* val; bool forced; } VALUE_PROMISE;
+
+        // A lazy cons, val is the head and tail usually a promise of
+        // the rest. The rest can also be nil or any other sequence.
+        struct VALUE_SEQ
+        { Value* val; Value* tail; } VALUE_SEQ;
+
+        // Packed i64s or f64s, see array.h
+        struct VALUE_ARRAY
+        { Array* val; } VALUE_ARRAY;
+
+        // Where a promoted nursery value went, only read by the gc
+        Value* forward;
     } val;
 
     bool marked;
 };
 
+// Not every Value* points at a Value. Heap values are at least 8 byte
+// aligned, so the low bits of the pointer are free to tag immediates:
+//
+//   ...1    fixnum, the integer is the word shifted right by one
+//   ..10    real, the bits of an f64 whose two lowest bits are zero
+//   .100    nil
+//
+// Integers and reals that don't fit are boxed like before. Use
+// value_tag and the value_as_* helpers instead of reading the fields.
+#define VALUE_IMM_MASK    ((uintptr_t)7)
+#define VALUE_FIXNUM_BIT  ((uintptr_t)1)
+#define VALUE_REAL_BIT    ((uintptr_t)2)
+#define VALUE_REAL_MASK   ((uintptr_t)3)
+#define VALUE_NIL_BITS    ((uintptr_t)4)
+
+#define FIXNUM_MIN (-((i64)1 << 62))
+#define FIXNUM_MAX (((i64)1 << 62) - 1)
+
+#define WISP_NIL ((Value*)VALUE_NIL_BITS)
+
+static inline bool value_is_heap(Value* val) {
+    return ((uintptr_t)val & VALUE_IMM_MASK) == 0;
+}
+
+static inline ValueTag value_tag(Value* val) {
+    uintptr_t bits = (uintptr_t)val;
+
+    if (bits & VALUE_FIXNUM_BIT) return VALUE_INTEGER;
+    if (bits & VALUE_REAL_BIT)   return VALUE_REAL;
+    if (bits & VALUE_NIL_BITS)   return VALUE_NIL;
+
+    return val->tag;
+}
+
+static inline f64 value_as_real(Value* val) {
+    uintptr_t bits = (uintptr_t)val;
+
+    // Two tag bits, the third one is part of the f64
+    if ((bits & VALUE_REAL_MASK) == VALUE_REAL_BIT) {
+        u64 raw = bits & ~(uintptr_t)3;
+        f64 real;
+        memcpy(&real, &raw, sizeof(f64));
+        return real;
+    }
+
+    return val->val.VALUE_REAL.val;
+}
+
+static inline i64 value_as_int(Value* val) {
+    if ((uintptr_t)val & VALUE_FIXNUM_BIT) {
+        return (intptr_t)val >> 1;
+    }
+
+    // Reals are truncated, nil reads as 0 like the zeroed field it used to be
+    if (value_tag(val) == VALUE_REAL) return (i64)value_as_real(val);
+    if (!value_is_heap(val)) return 0;
+
+    return val->val.VALUE_INTEGER.val;
+}
+
+Value* value_int(i64 num, Gc* gc);
+Value* value_real(f64 real, Gc* gc);
 Value* value_alloc(Value val, Gc* gc);
-Value* value_clone(Value* val, Gc* gc);
+void value_push(Gc* gc, Value* coll, Value* item);
 void value_print(Value* val);
 void value_mark(Value* val);
 void value_unmark(Value* val);
+void value_drop(Value* val);
 void value_free(Value* val);
 
+// Calls callee from native code, whichever backend it was made by.
+// force runs a promise's thunk the first time and hands back the same
+// value after that, anything that isn't a promise is returned as is.
+Value* value_call(Gc* gc, Env* env, Value* callee, Value_Vec args);
+Value* value_force(Gc* gc, Env* env, Value* promise);
+
+// Walks a list, vector, range or lazy sequence an item at a time,
+// ranges and sequences are never built up in memory. Forcing runs wisp
+// code that may collect, so what's being walked is kept on the gc's
+// shadow stack at root. Pop it with gc_pop_roots once done, even when
+// start says seq isn't something it can walk.
+typedef struct value_iter_t {
+    Gc* gc;
+    Env* env;
+    u64 root;
+    u64 index;
+} Value_Iter;
+
+bool value_iter_start(Value_Iter* it, Gc* gc, Env* env, Value* seq);
+bool value_iter_next(Value_Iter* it, Value** item);
+
 #endif  //__VALUE_H
@@ -0,0 +1,52 @@
+#ifndef __VM_H
+#define __VM_H
+
+#include "value.h"
+#include "chunk.h"
+
+// The stack is reserved once and never moves, natives get their args
+// as a pointer into it. Pages nothing has touched yet cost nothing.
+#define VM_STACK_MAX  (1 << 24)
+
+typedef struct call_frame_t {
+    Chunk* chunk;
+    u8* ip;
+
+    // Params and locals. They sit on the stack right above the callee,
+    // unless the fn calls set with a computed name, then they're the
+    // slots of scope.
+    Value** slots;
+    Env* scope;
+
+    // What the closure captured and the env it was made in
+    Value** captures;
+    Env* up;
+
+    // Stack index of the callee slot, everything from here up
+    // belongs to the frame and is dropped on return
+    usize base;
+} CallFrame;
+
+typedef struct vm_t {
+    Env* env;
+    Gc* gc;
+
+    Value** stack;
+    usize sp;
+
+    // Grows as calls nest, so a frame pointer is only good until the
+    // next call
+    CallFrame* frames;
+    usize frame_count;
+    usize frame_cap;
+
+    // Top level chunks that closures still point into
+    Chunk_Vec chunks;
+} Vm;
+
+Vm*    vm_new(Env* env, Gc* gc);
+void   vm_free(Vm* vm);
+Value* vm_run(Vm* vm, Chunk* chunk);
+Value* vm_call(Vm* vm, Value* callee, Value_Vec args);
+
+#endif  //__VM_H
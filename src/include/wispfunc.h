@@ -23,5 +23,34 @@ Value* wisp_car     (Gc* gc, Env* env, Value_Vec args);
 Value* wisp_cdr     (Gc* gc, Env* env, Value_Vec args);
 Value* wisp_append  (Gc* gc, Env* env, Value_Vec args);
 
+Value* wisp_promise   (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_force     (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_lazy_cons (Gc* gc, Env* env, Value_Vec args);
+
+Value* wisp_map       (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_filter    (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_reduce    (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_mapping   (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_filtering (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_taking    (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_pipeline  (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_transduce (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_sequence  (Gc* gc, Env* env, Value_Vec args);
+
+Value* wisp_i64_array    (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_f64_array    (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_sum          (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_min          (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_max          (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_dot          (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_array_ref    (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_array_length (Gc* gc, Env* env, Value_Vec args);
+
+Value* wisp_vector        (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_vector_push   (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_vector_ref    (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_vector_set    (Gc* gc, Env* env, Value_Vec args);
+Value* wisp_vector_length (Gc* gc, Env* env, Value_Vec args);
+
 #endif  //__WISP_FUNC_H
 
@@ -2,9 +2,47 @@
 
 #include <Pigeon/string.h>
 #include <stdio.h>
-#include <ctype.h>
 #include <stdlib.h>
 
+// Runs of whitespace, comments, symbols and strings are scanned a whole
+// vector at a time where the compiler lets us, the rest of the lexer
+// goes through the class tables one byte at a time
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LEX_WIDTH 32
+typedef __m256i LexVec;
+#define lex_load(p)    _mm256_loadu_si256((const __m256i*)(p))
+#define lex_set1(c)    _mm256_set1_epi8(c)
+#define lex_eq(a, b)   _mm256_cmpeq_epi8(a, b)
+#define lex_or(a, b)   _mm256_or_si256(a, b)
+#define lex_sub(a, b)  _mm256_sub_epi8(a, b)
+#define lex_min(a, b)  _mm256_min_epu8(a, b)
+#define lex_mask(a)    ((u32)_mm256_movemask_epi8(a))
+#define LEX_FULL       0xFFFFFFFFu
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define LEX_WIDTH 16
+typedef __m128i LexVec;
+#define lex_load(p)    _mm_loadu_si128((const __m128i*)(p))
+#define lex_set1(c)    _mm_set1_epi8(c)
+#define lex_eq(a, b)   _mm_cmpeq_epi8(a, b)
+#define lex_or(a, b)   _mm_or_si128(a, b)
+#define lex_sub(a, b)  _mm_sub_epi8(a, b)
+#define lex_min(a, b)  _mm_min_epu8(a, b)
+#define lex_mask(a)    ((u32)_mm_movemask_epi8(a))
+#define LEX_FULL       0xFFFFu
+#endif
+
+enum {
+    CC_SPACE = 1 << 0,
+    CC_DIGIT = 1 << 1,
+    CC_ALPHA = 1 << 2,
+    CC_SYM   = 1 << 3,
+};
+
+static u8 char_class[256];
+static TokenType char_token[256];
+
 static u32 err_line = 0;
 static u32 err_col = 0;
 
@@ -28,10 +66,143 @@ static char lexer_consume(Lexer* lexer);
 static bool lexer_bound(Lexer* lexer);
 static bool lexer_match(Lexer* lexer, char expected);
 
+static void lexer_init_tables() {
+    if (char_class['a'] != 0) return;
+
+    const char* spaces = " \t\n\v\f\r";
+    for (const char* c = spaces; *c; ++c) {
+        char_class[(u8)*c] = CC_SPACE;
+    }
+
+    for (int c = '0'; c <= '9'; ++c) char_class[c] = CC_DIGIT | CC_SYM;
+    for (int c = 'a'; c <= 'z'; ++c) char_class[c] = CC_ALPHA | CC_SYM;
+    for (int c = 'A'; c <= 'Z'; ++c) char_class[c] = CC_ALPHA | CC_SYM;
+    char_class['_'] = CC_SYM;
+
+    // Only inside a name, a leading - is still minus
+    char_class['-'] = CC_SYM;
+    char_class['!'] = CC_SYM;
+    char_class['?'] = CC_SYM;
+
+    char_token['>']  = Token_Greater;
+    char_token['<']  = Token_Less;
+    char_token['/']  = Token_Slash;
+    char_token['=']  = Token_Eq;
+    char_token['+']  = Token_Plus;
+    char_token['-']  = Token_Dash;
+    char_token['*']  = Token_Star;
+    char_token['(']  = Token_LParen;
+    char_token[')']  = Token_RParen;
+    char_token['\''] = Token_Tick;
+}
+
+#ifdef LEX_WIDTH
+// Bytes of v between lo and hi, both included
+static inline u32 lex_range(LexVec v, char lo, char hi) {
+    LexVec d = lex_sub(v, lex_set1(lo));
+    return lex_mask(lex_eq(lex_min(d, lex_set1(hi - lo)), d));
+}
+
+static inline u32 lex_space_mask(LexVec v) {
+    return lex_mask(lex_eq(v, lex_set1(' '))) | lex_range(v, '\t', '\r');
+}
+
+static inline u32 lex_sym_mask(LexVec v) {
+    return lex_range(lex_or(v, lex_set1(0x20)), 'a', 'z') |
+           lex_range(v, '0', '9') |
+           lex_mask(lex_or(lex_or(lex_eq(v, lex_set1('_')), lex_eq(v, lex_set1('-'))),
+                           lex_or(lex_eq(v, lex_set1('!')), lex_eq(v, lex_set1('?')))));
+}
+#endif
+
+// Skips whitespace, the line and column are fixed up once at the end
+static void lexer_skip_space(Lexer* lexer) {
+    const char* src = lexer->src.data;
+    u64 i = lexer->cursor;
+    u64 lines = 0;
+    u64 last_nl = 0;
+
+#ifdef LEX_WIDTH
+    while (i + LEX_WIDTH <= lexer->src.len) {
+        LexVec v = lex_load(src + i);
+        u32 nl = lex_mask(lex_eq(v, lex_set1('\n')));
+        u32 stop = ~lex_space_mask(v) & LEX_FULL;
+
+        if (stop) {
+            u32 n = __builtin_ctz(stop);
+            nl &= (1u << n) - 1;
+        }
+
+        if (nl) {
+            lines += __builtin_popcount(nl);
+            last_nl = i + 31 - __builtin_clz(nl);
+        }
+
+        if (stop) {
+            i += __builtin_ctz(stop);
+            goto done;
+        }
+
+        i += LEX_WIDTH;
+    }
+#endif
+
+    while (i < lexer->src.len && (char_class[(u8)src[i]] & CC_SPACE)) {
+        if (src[i] == '\n') {
+            lines++;
+            last_nl = i;
+        }
+        i++;
+    }
+
+#ifdef LEX_WIDTH
+done:
+#endif
+    if (lines > 0) {
+        lexer->line_number += lines;
+        lexer->column = i - last_nl - 1;
+    } else {
+        lexer->column += i - lexer->cursor;
+    }
+
+    lexer->cursor = i;
+}
+
+// Skips a ; comment up to the newline ending it
+static void lexer_skip_comment(Lexer* lexer) {
+    const char* src = lexer->src.data;
+    u64 i = lexer->cursor;
+
+#ifdef LEX_WIDTH
+    while (i + LEX_WIDTH <= lexer->src.len) {
+        LexVec v = lex_load(src + i);
+        u32 stop = lex_mask(lex_or(lex_eq(v, lex_set1('\n')), lex_eq(v, lex_set1(0))));
+
+        if (stop) {
+            i += __builtin_ctz(stop);
+            goto done;
+        }
+
+        i += LEX_WIDTH;
+    }
+#endif
+
+    while (i < lexer->src.len && src[i] != '\n' && src[i] != '\0') {
+        i++;
+    }
+
+#ifdef LEX_WIDTH
+done:
+#endif
+    lexer->column += i - lexer->cursor;
+    lexer->cursor = i;
+}
+
 Token token_new(TokenType type, String lexeme, u32 line, u32 col) {
     Token t;
     t.type = type;
     t.lexeme = lexeme;
+    t.escaped = false;
     t.line = line;
     t.col = col;
     return t;
@@ -63,63 +234,88 @@ String token_type_str(TokenType type) {
 }
 
 void token_print(Token t) {
-    printf("Token [Type: %s, Lexeme: %s]\n", 
+    printf("Token [Type: %s, Lexeme: %.*s]\n", 
            token_type_str(t.type).data, 
-           t.lexeme.data);
+           (int)t.lexeme.len, t.lexeme.data);
 }
 
 void token_loc_print(Token t) {
-    printf("Token [Type: %s, Lexeme: %s] %d:%d\n", 
+    printf("Token [Type: %s, Lexeme: %.*s] %d:%d\n", 
            token_type_str(t.type).data, 
-           t.lexeme.data,
+           (int)t.lexeme.len, t.lexeme.data,
            t.line,
            t.col);
 }
 
-static Token token_make_string(Lexer* lexer) {
-    usize buf_len = 0;
-    usize src_ptr = lexer->cursor;
-    char c;
-    while ((c = lexer->src.data[src_ptr++]) && c != '"') {
-        if (c == '\\') {
-            c = lexer->src.data[src_ptr];
-
-            switch (c) {
-                case 'n': buf_len++; src_ptr++; break;
-                case 'r': buf_len++; src_ptr++; break;
-                case 't': buf_len++; src_ptr++; break;
-                case 'b': buf_len++; src_ptr++; break;
-                case '\'': buf_len++; src_ptr++; break;
-                case '"': buf_len++; src_ptr++; break;
-                case '\\': buf_len++; src_ptr++; break;
-                default: break;
-            }
+// Tokens don't own their lexeme, it's the bit of the source from start
+// up to the cursor and is only good as long as the source is
+static Token token_slice(Lexer* lexer, TokenType type, u64 start) {
+    String lexeme = {.data = lexer->src.data + start, .len = lexer->cursor - start};
+    return token_new(type, lexeme, lexer->line_number, lexer->column);
+}
+
+// Copies a string literal into buf, which needs room for the whole
+// lexeme, and returns its length. Escapes are kept as they are written,
+// except \\ which becomes a single backslash.
+usize token_unescape(Token t, char* buf) {
+    String raw = t.lexeme;
+    usize len = 0;
+
+    for (usize i = 0; i < raw.len; ++i) {
+        buf[len++] = raw.data[i];
+        if (t.escaped && raw.data[i] == '\\' && i + 1 < raw.len && raw.data[i+1] == '\\') i++;
+    }
+
+    return len;
+}
+
+// Moves the cursor to the next quote, backslash or the end of the source
+static void lexer_skip_string_chars(Lexer* lexer) {
+    const char* src = lexer->src.data;
+    u64 i = lexer->cursor;
+
+#ifdef LEX_WIDTH
+    while (i + LEX_WIDTH <= lexer->src.len) {
+        LexVec v = lex_load(src + i);
+        u32 stop = lex_mask(lex_or(lex_or(lex_eq(v, lex_set1('"')), lex_eq(v, lex_set1('\\'))),
+                                   lex_eq(v, lex_set1(0))));
+
+        if (stop) {
+            i += __builtin_ctz(stop);
+            goto done;
         }
-        buf_len++;
+
+        i += LEX_WIDTH;
     }
+#endif
 
-    String buf = string_malloc(buf_len);
-    u64 buf_ptr = 0;
-    while (!lexer_bound(lexer) && lexer_peek(lexer) != '"') {
-        char c = lexer_peek(lexer);
-        if (c == '\\') {
-            lexer_advance(lexer);
-
-            switch (lexer_consume(lexer)) {
-                case 'n': buf.data[buf_ptr++] = '\\'; buf.data[buf_ptr++] = 'n'; break;
-                case 't': buf.data[buf_ptr++] = '\\'; buf.data[buf_ptr++] = 't'; break;
-                case 'r': buf.data[buf_ptr++] = '\\'; buf.data[buf_ptr++] = 'r'; break;
-                case 'b': buf.data[buf_ptr++] = '\\'; buf.data[buf_ptr++] = 'b'; break;
-                case '\'': buf.data[buf_ptr++] = '\\'; buf.data[buf_ptr++] = '\''; break;
-                case '"': buf.data[buf_ptr++] = '\\'; buf.data[buf_ptr++] = '"'; break;
-                case '\\': buf.data[buf_ptr++] = '\\'; break;
-                default: 
-                    LexerErr("Unknown Escape Char", lexer);
+    while (i < lexer->src.len && src[i] != '"' && src[i] != '\\' && src[i] != '\0') {
+        i++;
+    }
 
-            }
-        } else {
-            buf.data[buf_ptr++] = c;
-            lexer_advance(lexer);
+#ifdef LEX_WIDTH
+done:
+#endif
+    lexer->column += i - lexer->cursor;
+    lexer->cursor = i;
+}
+
+static Token token_make_string(Lexer* lexer) {
+    u64 start = lexer->cursor;
+    bool escaped = false;
+
+    for (;;) {
+        lexer_skip_string_chars(lexer);
+        if (lexer_bound(lexer) || lexer_peek(lexer) == '"') break;
+
+        lexer_advance(lexer);
+        escaped = true;
+        switch (lexer_consume(lexer)) {
+            case 'n': case 't': case 'r': case 'b':
+            case '\'': case '"': case '\\':
+                break;
+            default: 
+                LexerErr("Unknown Escape Char", lexer);
         }
     }
 
@@ -127,33 +323,22 @@ static Token token_make_string(Lexer* lexer) {
         LexerErr("Unterminated String", lexer);
     } 
 
-    lexer_advance(lexer);
+    Token t = token_slice(lexer, Token_String, start);
+    t.escaped = escaped;
 
-    return token_new(Token_String, buf, lexer->line_number, lexer->column);
+    lexer_advance(lexer);
+    return t;
 }
 
 static Token token_make_number(Lexer* lexer) {
-    usize buf_len = 0;
-    usize src_ptr = lexer->cursor-1;
-    char c;
-    while ((c = lexer->src.data[src_ptr++]) && 
-        (isdigit(c) || c == '.')) {
-        buf_len++;
-    }
-
-    String buf = string_malloc(buf_len);
-    
-    u64 buf_ptr = 0;
+    u64 start = lexer->cursor - 1;
     bool dec_point = false;
 
-    buf.data[buf_ptr++] = lexer_peek_offset(lexer, -1);
-
-    while (!lexer_bound(lexer) &&
-    (isdigit(lexer_peek(lexer)) || lexer_peek(lexer) == '.')) {
-        char c = lexer_peek(lexer);
-        if (c == '.') {
+    while ((char_class[(u8)lexer_peek(lexer)] & CC_DIGIT) || lexer_peek(lexer) == '.') {
+        if (lexer_peek(lexer) == '.') {
+            // 1..5 is a range, not a float
             if (lexer_peek_offset(lexer, 1) == '.') {
-                return token_new(Token_Number, buf, lexer->line_number, lexer->column);
+                break;
             }
 
             if (dec_point) {
@@ -163,35 +348,41 @@ static Token token_make_number(Lexer* lexer) {
             dec_point = true; 
         } 
 
-        buf.data[buf_ptr++] = c;
         lexer_advance(lexer);
     }
 
-    return token_new(Token_Number, buf, lexer->line_number, lexer->column);
+    return token_slice(lexer, Token_Number, start);
 }
 
 static Token token_make_sym(Lexer* lexer) {
-    usize buf_len = 0;
-    usize src_ptr = lexer->cursor-1;
-    char c;
-    while ((c = lexer->src.data[src_ptr++]) && 
-        (isalnum(c) || c == '_')) {
-        buf_len++;
-    }
+    const char* src = lexer->src.data;
+    u64 start = lexer->cursor - 1;
+    u64 i = lexer->cursor;
 
-    String buf = string_malloc(buf_len);
-    u64 buf_ptr = 0;
+#ifdef LEX_WIDTH
+    while (i + LEX_WIDTH <= lexer->src.len) {
+        u32 stop = ~lex_sym_mask(lex_load(src + i)) & LEX_FULL;
 
-    buf.data[buf_ptr++] = lexer_peek_offset(lexer, -1);
+        if (stop) {
+            i += __builtin_ctz(stop);
+            goto done;
+        }
+
+        i += LEX_WIDTH;
+    }
+#endif
 
-    while (!lexer_bound(lexer) &&
-            (isalnum(lexer_peek(lexer)) || lexer_peek(lexer) == '_')) {
-          buf.data[buf_ptr++] = lexer_consume(lexer);
+    while (i < lexer->src.len && (char_class[(u8)src[i]] & CC_SYM)) {
+        i++;
     }
 
-    buf.len = buf_ptr;
+#ifdef LEX_WIDTH
+done:
+#endif
+    lexer->column += i - lexer->cursor;
+    lexer->cursor = i;
 
-    return token_new(Token_Symbol, buf, lexer->line_number, lexer->column);
+    return token_slice(lexer, Token_Symbol, start);
 }
 
 /*
@@ -207,6 +398,8 @@ Lexer* lexer_new(Arena* a, String src) {
     l->line_number = 1;
 
     l->arena = a;
+
+    lexer_init_tables();
     
     return l;
 }
@@ -215,11 +408,14 @@ static void lexer_free(Lexer* lexer) {
     arena_free(lexer->arena);
 }
 
+// The source may be mapped straight from a file, so nothing past len
+// is ever read. A NUL still ends it like it always did.
 static bool lexer_bound(Lexer* lexer) {
-    return lexer->src.data[lexer->cursor] == '\0';
+    return lexer->cursor >= lexer->src.len || lexer->src.data[lexer->cursor] == '\0';
 }
 
 static char lexer_peek_offset(Lexer* lexer, usize offset) {
+    if (lexer->cursor + offset >= lexer->src.len) return '\0';
     return lexer->src.data[lexer->cursor+offset];
 }
 
@@ -247,71 +443,47 @@ static void lexer_advance(Lexer* lexer) {
 }
 
 Token lexer_next_token(Lexer* lexer) {
+    for (;;) {
+        lexer_skip_space(lexer);
+        if (lexer_peek(lexer) != ';') break;
+        lexer_skip_comment(lexer);
+    }
+
     if (lexer_bound(lexer)) {
         return token(Token_EOF, lexer->line_number, lexer->column);
     }
 
+    u64 start = lexer->cursor;
     char c = lexer_consume(lexer);
+    TokenType type = char_token[(u8)c];
+
+    if (type != Token_None) {
+        switch (type) {
+            case Token_Greater: if (lexer_match(lexer, '=')) type = Token_GreaterEq; break;
+            case Token_Less:    if (lexer_match(lexer, '=')) type = Token_LessEq;    break;
+            case Token_Slash:   if (lexer_match(lexer, '=')) type = Token_Neq;       break;
+            default: break;
+        }
 
-    if (c == '\n') {
-        lexer->line_number++;
-        lexer->column = 0;
+        return token_slice(lexer, type, start);
     }
 
-    if (isspace(c)) {
-        return lexer_next_token(lexer);
-    }
-    switch (c) {
-        case ';': {
-            while (!lexer_bound(lexer) && lexer_peek(lexer) != '\n') {
-                lexer_consume(lexer);
-            }
-            return lexer_next_token(lexer);
-        }
-        case '>': {
-            if (lexer_match(lexer, '=')) {
-                return token_new(Token_GreaterEq, string(">="), lexer->line_number, lexer->column);
-            } 
-
-            return token_new(Token_Greater, string(">"), lexer->line_number, lexer->column);
-        }
-        case '<': {
-            if (lexer_match(lexer, '=')) {
-                return token_new(Token_LessEq, string("<"), lexer->line_number, lexer->column);
-            } 
+    u8 class = char_class[(u8)c];
 
-            return token_new(Token_Less, string("<"), lexer->line_number, lexer->column);
-        }
-        case '/': {
-            if (lexer_match(lexer, '=')) {
-                return token_new(Token_Neq, string("/="), lexer->line_number, lexer->column);
-            } 
+    if (class & CC_DIGIT) {
+        return token_make_number(lexer);
+    }
 
-            return token_new(Token_Slash, string("/"), lexer->line_number, lexer->column);
-        }
-        case '=': return token_new(Token_Eq, string("="), lexer->line_number, lexer->column);
-        case '+': return token_new(Token_Plus, string("+"), lexer->line_number, lexer->column);
-        case '-': return token_new(Token_Dash, string("-"), lexer->line_number, lexer->column);
-        case '*': return token_new(Token_Star, string("*"), lexer->line_number, lexer->column);
-        case '"': return token_make_string(lexer);
-        case '(': return token_new(Token_LParen, string("("), lexer->line_number, lexer->column);
-        case ')': return token_new(Token_RParen, string(")"), lexer->line_number, lexer->column);
-        case '\'': return token_new(Token_Tick,  string("\'"), lexer->line_number, lexer->column);
-        case '0': case '1': case '2': case '3': case '4':
-        case '5': case '6': case '7': case '8': case '9': {
-            return token_make_number(lexer);
-        }
-        default: {
-            if (isalpha(c)) {
-                return token_make_sym(lexer);
-            }
+    if (class & CC_ALPHA) {
+        return token_make_sym(lexer);
+    }
 
-            printf("%c\n", c);
-            LexerErr("Unexpected Token", lexer);
-        }
+    if (c == '"') {
+        return token_make_string(lexer);
     }
 
+    printf("%c\n", c);
+    LexerErr("Unexpected Token", lexer);
+
     return token(Token_Unexpected, lexer->line_number, lexer->column);
 }
-
-
@@ -1,6 +1,7 @@
 #include "include/parser.h"
 #include "include/ast.h"
 #include "include/lexer.h"
+#include "include/symbol.h"
 #include <Pigeon/arena.h>
 #include <Pigeon/defines.h>
 #include <Pigeon/string.h>
@@ -9,21 +10,20 @@
 #include <string.h>
 
 static void parser_advance(Parser* p);
-static AST* parse_form(Parser* p);
-static AST* parse_atom(Parser* p);
-static AST* parse_sym(Parser* p);
-static AST* parse_number(Parser* p);
-static AST* parse_str(Parser* p);
-static AST* parse_list(Parser* p);
-static AST* parse_fn(Parser* p);
-static AST* parse_def(Parser* p);
-static AST* parse_let(Parser* p);
-static AST* parse_if(Parser* p);
+static AST_Id parse_form(Parser* p);
+static AST_Id parse_atom(Parser* p);
+static AST_Id parse_sym(Parser* p);
+static AST_Id parse_number(Parser* p);
+static AST_Id parse_str(Parser* p);
+static AST_Id parse_list(Parser* p);
+static AST_Id parse_fn(Parser* p);
+static AST_Id parse_def(Parser* p);
+static AST_Id parse_let(Parser* p);
+static AST_Id parse_if(Parser* p);
+static AST_Id parse_delay(Parser* p);
 
 
 static void parser_advance(Parser* p) {
-    string_free(&p->prev.lexeme);
-
     p->prev = p->curr;
     p->curr = p->next;
     p->next = lexer_next_token(p->lexer);
@@ -33,7 +33,12 @@ Parser* parser_new(Arena* arena, Lexer* lexer) {
     Parser* p = arena_alloc(arena, sizeof(Parser));
     p->arena = arena;
     p->lexer = lexer;
-    p->ast = AST_NEW(AST_PROG, ast_vec_new());
+    p->ast = AST_NONE;
+    p->tree = ast_tree_new();
+
+    p->stack_cap = DATA_START_CAPACITY;
+    p->stack_len = 0;
+    p->stack = arena_alloc(arena, p->stack_cap * sizeof(AST_Id));
 
     parser_advance(p);
     parser_advance(p);
@@ -41,8 +46,7 @@ Parser* parser_new(Arena* arena, Lexer* lexer) {
 }
 
 void parser_set_src(Parser* parser, String src) {
-    ast_free(parser->ast);
-    parser->ast = AST_NEW(AST_PROG, ast_vec_new());
+    parser->ast = AST_NONE;
     parser->lexer->src = src;
     parser->lexer->cursor = 0;
     parser->lexer->column = 0;
@@ -50,63 +54,122 @@ void parser_set_src(Parser* parser, String src) {
     parser_advance(parser);
 }
 
-static AST* parse_fn(Parser* p) {
+// Hands over the tree with everything parsed so far, the caller frees
+// it once nothing points into the forms anymore
+AST_Tree* parser_detach(Parser* parser) {
+    AST_Tree* tree = parser->tree;
+    parser->tree = ast_tree_new();
+    parser->ast = AST_NONE;
+    return tree;
+}
+
+// Children are collected on the parser's stack until their list is
+// done, then copied into the tree as one run. Lists nest, so each one
+// only takes the items above where it started.
+static void parser_push(Parser* p, AST_Id item) {
+    if (p->stack_len >= p->stack_cap) {
+        AST_Id* stack = arena_alloc(p->arena, p->stack_cap * 2 * sizeof(AST_Id));
+        ASSERT(stack != NULL, "outta ram");
+        memcpy(stack, p->stack, p->stack_len * sizeof(AST_Id));
+        p->stack = stack;
+        p->stack_cap *= 2;
+    }
+
+    p->stack[p->stack_len++] = item;
+}
+
+static AST_Data parser_pop_kids(Parser* p, usize base) {
+    AST_Data data;
+    data.kids.len = p->stack_len - base;
+    data.kids.start = ast_add_kids(p->tree, p->stack + base, data.kids.len);
+    p->stack_len = base;
+    return data;
+}
+
+static AST_Id parse_fn(Parser* p) {
     parser_advance(p);
-    AST* params = parse_list(p);
+    AST_Id params = parse_list(p);
     parser_advance(p);
-    if (params->tag != AST_LIST) {
-        ast_free(p->ast);
-        free(params);
+    if (ast_tag(p->tree, params) != AST_LIST) {
         printf("Invalid tokens following fn name");
     }
 
-    AST_Vec* body = ast_vec_new();
+    usize base = p->stack_len;
     while (p->curr.type != Token_RParen) {
-        ast_vec_append(body, parse_form(p));
+        parser_push(p, parse_form(p));
         parser_advance(p);
     }
 
-    return AST_NEW(AST_FN, params, body);
+    AST_Data body = parser_pop_kids(p, base);
+    AST_Fn fn = {params, body.kids.start, body.kids.len, 0, false, 0, 0, 0, 0};
+    return ast_new(p->tree, AST_FN, (AST_Data){.fn = ast_add_fn(p->tree, fn)});
 }
 
-static AST* parse_if(Parser* p) {
-    parser_advance(p);
-    AST* condition = parse_form(p);
+static AST_Id parse_if(Parser* p) {
+    usize base = p->stack_len;
+
+    // condition, then, else
+    for (i32 i = 0; i < 3; ++i) {
+        parser_advance(p);
+        parser_push(p, parse_form(p));
+    }
     parser_advance(p);
-    AST* then_branch = parse_form(p);
+
+    return ast_new(p->tree, AST_IF, parser_pop_kids(p, base));
+}
+
+// (delay e) is (promise (fn () e)), nothing past the parser knows
+static AST_Id parse_delay(Parser* p) {
     parser_advance(p);
-    AST* else_branch = parse_form(p);
+    AST_Id expr = parse_form(p);
     parser_advance(p);
 
-    return AST_NEW(AST_IF, condition, then_branch, else_branch);
+    usize base = p->stack_len;
+    AST_Id params = ast_new(p->tree, AST_LIST, parser_pop_kids(p, base));
+
+    parser_push(p, expr);
+    AST_Data body = parser_pop_kids(p, base);
+    AST_Fn fn = {params, body.kids.start, body.kids.len, 0, false, 0, 0, 0, 0};
+    AST_Id thunk = ast_new(p->tree, AST_FN, (AST_Data){.fn = ast_add_fn(p->tree, fn)});
+
+    Symbol* sym = symbol_intern(string("promise"));
+    parser_push(p, ast_new(p->tree, AST_SYM, (AST_Data){.sym = {sym->id, 0}}));
+    parser_push(p, thunk);
+    return ast_new(p->tree, AST_LIST, parser_pop_kids(p, base));
 }
 
-static AST* parse_def(Parser* p) {
+static AST_Id parse_def(Parser* p) {
     parser_advance(p);
     (void)p;
-    return AST_NEW(AST_NIL, 0);
+    return ast_new(p->tree, AST_NIL, (AST_Data){0});
 }
 
-static AST* parse_let(Parser* p) {
+static AST_Id parse_let(Parser* p) {
     parser_advance(p);
     (void)p;
-    return AST_NEW(AST_NIL, 0);
+    return ast_new(p->tree, AST_NIL, (AST_Data){0});
 }
 
-static AST* parse_number(Parser* p) {
-    return AST_NEW(AST_NUMBER, string_to_number(p->curr.lexeme));
+static AST_Id parse_number(Parser* p) {
+    return ast_new(p->tree, AST_NUMBER, (AST_Data){.number = string_to_number(p->curr.lexeme)});
 }
 
-static AST* parse_sym(Parser* p) {
-    String s = string_malloc_str(p->curr.lexeme.data);
-    return AST_NEW(AST_SYM, s);
+static AST_Id parse_sym(Parser* p) {
+    Symbol* sym = symbol_intern(p->curr.lexeme);
+    return ast_new(p->tree, AST_SYM, (AST_Data){.sym = {sym->id, 0}});
 }
-static AST* parse_str(Parser* p) {
-    String s = string_malloc_str(p->curr.lexeme.data);
-    return AST_NEW(AST_STR, s);
+static AST_Id parse_str(Parser* p) {
+    AST_Tree* tree = p->tree;
+    char* buf = ast_reserve_text(tree, p->curr.lexeme.len);
+    u32 len = token_unescape(p->curr, buf);
+    buf[len] = '\0';
+
+    AST_Data data = {.str = {tree->text_len, len}};
+    tree->text_len += len + 1;
+    return ast_new(tree, AST_STR, data);
 }
 
-static AST* parse_atom(Parser* p) {
+static AST_Id parse_atom(Parser* p) {
     switch (p->curr.type) {
         case Token_Number: {
             return parse_number(p);
@@ -129,35 +192,29 @@ static AST* parse_atom(Parser* p) {
 
         case Token_Tick: {
             parser_advance(p);
-            AST* ast = parse_form(p);
-            ast->eval = false;
+            AST_Id ast = parse_form(p);
+            p->tree->flags[ast] |= AST_QUOTED;
             return ast;
         };
         default: {
             token_loc_print(p->curr);
             puts("(Unknown Token)");
-            return AST_NEW(AST_NIL, NULL);
+            return ast_new(p->tree, AST_NIL, (AST_Data){0});
         }
     }
 }
 
-static AST* parse_list(Parser* p) {
-    AST* list = AST_NEW(AST_LIST, ast_vec_new());
-    struct AST_LIST data = list->data.AST_LIST;
+static AST_Id parse_list(Parser* p) {
+    usize base = p->stack_len;
 
     while (p->next.type != Token_RParen) {
-        AST* item;
+        AST_Id item;
         parser_advance(p);
         if (p->curr.type == Token_LParen) {
             item = parse_form(p);
         }
         else if (p->curr.type == Token_EOF) {
-            string_free(&p->prev.lexeme);
-            string_free(&p->curr.lexeme);
-            string_free(&p->next.lexeme);
-
-            ast_free(list);
-            ast_free(p->ast);
+            ast_tree_free(p->tree);
             token_loc_print(p->curr);
             arena_free(p->arena);
             ASSERT(0, "Unbalanced Parens");
@@ -165,20 +222,19 @@ static AST* parse_list(Parser* p) {
         }
         else {
             item = parse_atom(p);
-            if (item->tag == AST_NIL) {
-                free(item);
+            if (ast_tag(p->tree, item) == AST_NIL) {
                 break;
             }
         }
 
-        ast_vec_append(data.vec, item);
+        parser_push(p, item);
     }
 
     parser_advance(p);
-    return list;
+    return ast_new(p->tree, AST_LIST, parser_pop_kids(p, base));
 }
 
-static AST* parse_form(Parser* p) {
+static AST_Id parse_form(Parser* p) {
     if (p->curr.type == Token_LParen) {
         if (p->next.type == Token_Symbol) {
             String sym = p->next.lexeme;
@@ -194,6 +250,14 @@ static AST* parse_form(Parser* p) {
                 parser_advance(p);
                 return parse_let(p);
             }  
+            else if (string_eq(sym, string("if"))) {
+                parser_advance(p);
+                return parse_if(p);
+            }
+            else if (string_eq(sym, string("delay"))) {
+                parser_advance(p);
+                return parse_delay(p);
+            }
         }
 
         return parse_list(p);
@@ -202,15 +266,25 @@ static AST* parse_form(Parser* p) {
     return parse_atom(p);
 }
 
-void parser_parse(Parser* parser) {
-    AST_Vec* vec = parser->ast->data.AST_PROG.vec;
-    while (parser->curr.type != Token_EOF) {
-        ast_vec_append(vec, parse_form(parser));
-        parser_advance(parser);
+// Parses the next top level form, AST_NONE once the source runs out.
+// The form isn't added to parser->ast, it lives in the parser's tree
+// until that's detached.
+AST_Id parser_next_form(Parser* parser) {
+    if (parser->curr.type == Token_EOF) {
+        return AST_NONE;
     }
 
-    string_free(&parser->prev.lexeme);
-    string_free(&parser->curr.lexeme);
-    string_free(&parser->next.lexeme);
+    AST_Id form = parse_form(parser);
+    parser_advance(parser);
+    return form;
 }
 
+void parser_parse(Parser* parser) {
+    usize base = parser->stack_len;
+    AST_Id form;
+    while ((form = parser_next_form(parser)) != AST_NONE) {
+        parser_push(parser, form);
+    }
+
+    parser->ast = ast_new(parser->tree, AST_PROG, parser_pop_kids(parser, base));
+}
@@ -0,0 +1,136 @@
+#include "include/pool.h"
+#include "include/array.h"
+#include "include/ast.h"
+#include "include/env.h"
+#include "include/value.h"
+#include <Pigeon/defines.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Freed objects are poisoned so ASan still catches use after free
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#define POOL_POISON(ptr, size)   ASAN_POISON_MEMORY_REGION(ptr, size)
+#define POOL_UNPOISON(ptr, size) ASAN_UNPOISON_MEMORY_REGION(ptr, size)
+#else
+#define POOL_POISON(ptr, size)   ((void)(ptr), (void)(size))
+#define POOL_UNPOISON(ptr, size) ((void)(ptr), (void)(size))
+#endif
+
+// Objects start 16 bytes into a slab so they keep malloc's alignment,
+// Value pointers need their low three bits free for tagging
+#define POOL_SLAB_HEADER 16
+
+typedef struct pool_slab_t {
+    struct pool_slab_t* next;
+} PoolSlab;
+
+typedef struct pool_t {
+    const char* name;
+    usize size;
+
+    void* free_list;
+    PoolSlab* slabs;
+
+    PoolStats stats;
+} Pool;
+
+#define POOL_CLASS(type) {#type, (sizeof(type) + 7) & ~(usize)7, NULL, NULL, {0}}
+
+static Pool pools[POOL_COUNT] = {
+    [POOL_VALUE]     = POOL_CLASS(Value),
+    [POOL_VALUE_VEC] = POOL_CLASS(Value_Vec),
+    [POOL_LAMBDA]    = POOL_CLASS(Lambda),
+    [POOL_ENV]       = POOL_CLASS(Env),
+    [POOL_ARRAY]     = POOL_CLASS(Array),
+};
+
+static void pool_grow(Pool* pool) {
+    PoolSlab* slab = malloc(POOL_SLAB_SIZE);
+    ASSERT(slab != NULL, "outta ram");
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->stats.slabs++;
+
+    u8* start = (u8*)slab + POOL_SLAB_HEADER;
+    usize count = (POOL_SLAB_SIZE - POOL_SLAB_HEADER) / pool->size;
+
+    // Thread the free list back to front so allocation walks the
+    // slab in address order
+    for (usize i = count; i-- > 0;) {
+        void* obj = start + i * pool->size;
+        *(void**)obj = pool->free_list;
+        pool->free_list = obj;
+        POOL_POISON(obj, pool->size);
+    }
+}
+
+void* pool_alloc(PoolClass cls) {
+    Pool* pool = &pools[cls];
+
+    if (pool->free_list == NULL) {
+        pool_grow(pool);
+    }
+
+    void* obj = pool->free_list;
+    POOL_UNPOISON(obj, pool->size);
+    pool->free_list = *(void**)obj;
+
+    if (++pool->stats.live > pool->stats.peak) {
+        pool->stats.peak = pool->stats.live;
+    }
+
+    return obj;
+}
+
+void* pool_calloc(PoolClass cls) {
+    void* obj = pool_alloc(cls);
+    memset(obj, 0, pools[cls].size);
+    return obj;
+}
+
+void pool_free(PoolClass cls, void* ptr) {
+    if (ptr == NULL) return;
+
+    Pool* pool = &pools[cls];
+    *(void**)ptr = pool->free_list;
+    pool->free_list = ptr;
+    pool->stats.live--;
+    POOL_POISON(ptr, pool->size);
+}
+
+PoolStats pool_stats(PoolClass cls) {
+    return pools[cls].stats;
+}
+
+const char* pool_class_name(PoolClass cls) {
+    return pools[cls].name;
+}
+
+void pool_print_stats() {
+    for (usize i = 0; i < POOL_COUNT; ++i) {
+        Pool* pool = &pools[i];
+        printf("%-10s live: %-8lu peak: %-8lu slabs: %lu\n",
+               pool->name, pool->stats.live, pool->stats.peak, pool->stats.slabs);
+    }
+}
+
+// Hands every slab back, anything still allocated from them is gone
+void pool_release_all() {
+    for (usize i = 0; i < POOL_COUNT; ++i) {
+        Pool* pool = &pools[i];
+        PoolSlab* slab = pool->slabs;
+
+        while (slab != NULL) {
+            PoolSlab* next = slab->next;
+            POOL_UNPOISON(slab, POOL_SLAB_SIZE);
+            free(slab);
+            slab = next;
+        }
+
+        pool->slabs = NULL;
+        pool->free_list = NULL;
+        pool->stats = (PoolStats){0};
+    }
+}
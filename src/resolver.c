@@ -0,0 +1,452 @@
+#include "include/resolver.h"
+#include "include/ast.h"
+#include "include/env.h"
+#include "include/symbol.h"
+#include <Pigeon/defines.h>
+#include <Pigeon/string.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct local_t {
+    Symbol* name;
+    bool assigned;
+    bool boxed;
+
+    // Params always are, a set's local only once the set has been
+    // resolved. Reads before that see whatever name meant outside.
+    bool bound;
+
+    // Bound on some path but maybe not this one, the read checks the
+    // slot and sees what name means outside while it's empty
+    bool maybe;
+} Local;
+
+// Bound if the local was when the closure was made, otherwise its
+// box may still be empty when the closure reads it
+typedef struct upvalue_t {
+    Symbol* name;
+    Capture from;
+    bool boxed;
+    bool bound;
+} Upvalue;
+
+typedef struct scope_t {
+    struct scope_t* parent;
+    Local* locals;
+    u32 len;
+    u32 cap;
+
+    // The enclosing fns' variables the body uses
+    Upvalue* captures;
+    u32 capture_len;
+    u32 capture_cap;
+} Scope;
+
+static void resolve_ast(AST_Tree* tree, AST_Id id, Scope* scope, Env* globals);
+
+static u32 scope_declare(Scope* scope, Symbol* name) {
+    for (u32 i = 0; i < scope->len; ++i) {
+        if (scope->locals[i].name == name) {
+            return i;
+        }
+    }
+
+    if (scope->len >= scope->cap) {
+        scope->cap = scope->cap == 0 ? DATA_START_CAPACITY : scope->cap * 2;
+        scope->locals = realloc(scope->locals, scope->cap * sizeof(Local));
+        ASSERT(scope->locals != NULL, "outta ram");
+    }
+
+    scope->locals[scope->len++] = (Local){name, false, false, false, false};
+    return scope->len - 1;
+}
+
+// Whether name is a local of one of the fns the scope is nested in
+static bool scope_encloses(Scope* scope, Symbol* name) {
+    for (Scope* outer = scope->parent; outer != NULL; outer = outer->parent) {
+        for (u32 i = 0; i < outer->len; ++i) {
+            if (outer->locals[i].name == name) return true;
+        }
+    }
+
+    return false;
+}
+
+static bool scope_has(Scope* scope, Symbol* name) {
+    for (u32 i = 0; i < scope->len; ++i) {
+        if (scope->locals[i].name == name) return true;
+    }
+
+    return false;
+}
+
+// Returns the index of name in the scope's captures, adding it and
+// the captures of the fns in between if it's a local of some
+// enclosing fn. -1 if it isn't, then it's a global.
+static i64 scope_capture(Scope* scope, Symbol* name) {
+    for (u32 i = 0; i < scope->capture_len; ++i) {
+        if (scope->captures[i].name == name) {
+            return i;
+        }
+    }
+
+    Scope* parent = scope->parent;
+    if (parent == NULL) return -1;
+
+    Upvalue up = {name, {false, 0}, false, false};
+    bool found = false;
+
+    for (u32 i = 0; i < parent->len; ++i) {
+        if (parent->locals[i].name == name) {
+            up.from = (Capture){true, i};
+            up.boxed = parent->locals[i].boxed;
+            up.bound = parent->locals[i].bound;
+            found = true;
+            break;
+        }
+    }
+
+    if (!found) {
+        i64 index = scope_capture(parent, name);
+        if (index < 0) return -1;
+
+        up.from = (Capture){false, index};
+        up.boxed = parent->captures[index].boxed;
+        up.bound = parent->captures[index].bound;
+    }
+
+    if (scope->capture_len >= scope->capture_cap) {
+        scope->capture_cap = scope->capture_cap == 0 ? DATA_START_CAPACITY : scope->capture_cap * 2;
+        scope->captures = realloc(scope->captures, scope->capture_cap * sizeof(Upvalue));
+        ASSERT(scope->captures != NULL, "outta ram");
+    }
+
+    scope->captures[scope->capture_len++] = up;
+    return scope->capture_len - 1;
+}
+
+static bool is_literal_set(AST_Tree* tree, AST_Id id) {
+    if (ast_tag(tree, id) != AST_LIST || !ast_is_eval(tree, id)) return false;
+    if (ast_len(tree, id) != 3) return false;
+
+    AST_Id* kids = ast_kids(tree, id);
+    AST_Id head = kids[0];
+    AST_Id sym = kids[1];
+
+    return ast_tag(tree, head) == AST_SYM && ast_is_eval(tree, head) &&
+           ast_sym(tree, head) == symbol_intern(string("set")) &&
+           ast_tag(tree, sym) == AST_SYM && !ast_is_eval(tree, sym);
+}
+
+// Locals are hoisted, a (set 'x ...) anywhere in the body makes x a slot
+// of the fn, though only what comes after the set reads it. Setting a
+// local of an enclosing fn changes that one instead, so a closure can
+// keep state in what it captured. Nested fns get their own scope.
+static void declare_locals(AST_Tree* tree, AST_Id id, Scope* scope) {
+    if (!ast_is_eval(tree, id)) return;
+
+    switch (ast_tag(tree, id)) {
+        case AST_LIST: {
+            AST_Id* kids = ast_kids(tree, id);
+
+            if (is_literal_set(tree, id)) {
+                Symbol* name = ast_sym(tree, kids[1]);
+
+                if (scope_has(scope, name) || !scope_encloses(scope, name)) {
+                    u32 slot = scope_declare(scope, name);
+                    scope->locals[slot].assigned = true;
+                }
+            }
+
+            for (u32 i = 0; i < ast_len(tree, id); ++i) {
+                declare_locals(tree, kids[i], scope);
+            }
+            break;
+        }
+        case AST_IF: {
+            AST_Id* kids = ast_kids(tree, id);
+            declare_locals(tree, kids[0], scope);
+            declare_locals(tree, kids[1], scope);
+            declare_locals(tree, kids[2], scope);
+            break;
+        }
+        default: break;
+    }
+}
+
+// A frame has to go on the heap when the body may call set with a
+// computed name, that binds into the frame's env. Runs before the body
+// is resolved, so literal sets are still lists.
+static bool needs_heap_frame(AST_Tree* tree, AST_Id id) {
+    if (!ast_is_eval(tree, id)) return false;
+
+    switch (ast_tag(tree, id)) {
+        case AST_SYM: return ast_sym(tree, id) == symbol_intern(string("set"));
+        case AST_LIST: {
+            AST_Id* kids = ast_kids(tree, id);
+
+            if (is_literal_set(tree, id)) {
+                return needs_heap_frame(tree, kids[2]);
+            }
+
+            for (u32 i = 0; i < ast_len(tree, id); ++i) {
+                if (needs_heap_frame(tree, kids[i])) return true;
+            }
+            return false;
+        }
+        case AST_IF: {
+            AST_Id* kids = ast_kids(tree, id);
+            return needs_heap_frame(tree, kids[0]) ||
+                   needs_heap_frame(tree, kids[1]) ||
+                   needs_heap_frame(tree, kids[2]);
+        }
+        default: return false;
+    }
+}
+
+// Whether a fn nested in the node uses name without it being one of
+// its params, and whether one of them sets it
+static void captured(AST_Tree* tree, AST_Id id, Symbol* name, bool nested, bool* used, bool* set) {
+    if (!ast_is_eval(tree, id)) return;
+
+    switch (ast_tag(tree, id)) {
+        case AST_SYM: {
+            if (nested && ast_sym(tree, id) == name) *used = true;
+            return;
+        }
+        case AST_LIST: {
+            AST_Id* kids = ast_kids(tree, id);
+
+            if (nested && is_literal_set(tree, id) && ast_sym(tree, kids[1]) == name) {
+                *used = true;
+                *set = true;
+            }
+
+            for (u32 i = 0; i < ast_len(tree, id); ++i) {
+                captured(tree, kids[i], name, nested, used, set);
+            }
+            return;
+        }
+        case AST_IF: {
+            AST_Id* kids = ast_kids(tree, id);
+            captured(tree, kids[0], name, nested, used, set);
+            captured(tree, kids[1], name, nested, used, set);
+            captured(tree, kids[2], name, nested, used, set);
+            return;
+        }
+        case AST_FN: {
+            AST_Fn* fn = ast_fn(tree, id);
+            AST_Id* params = ast_kids(tree, fn->params);
+            AST_Id* body = &tree->kids[fn->body];
+
+            for (u32 i = 0; i < ast_len(tree, fn->params); ++i) {
+                if (ast_sym(tree, params[i]) == name) return;
+            }
+
+            for (u32 i = 0; i < fn->body_len; ++i) {
+                captured(tree, body[i], name, true, used, set);
+            }
+            return;
+        }
+        default: return;
+    }
+}
+
+static void sym_bind(AST_Tree* tree, AST_Id id, SymKind kind, bool boxed, u32 slot) {
+    u8 quoted = tree->flags[id] & AST_QUOTED;
+    tree->flags[id] = quoted | (kind << AST_KIND_SHIFT) | (boxed ? AST_BOXED : 0);
+    tree->data[id].sym.slot = slot;
+}
+
+static void resolve_sym(AST_Tree* tree, AST_Id id, Scope* scope, Env* globals) {
+    Symbol* sym = ast_sym(tree, id);
+
+    if (scope != NULL) {
+        for (u32 i = 0; i < scope->len; ++i) {
+            if (scope->locals[i].name == sym && scope->locals[i].maybe) {
+                sym_bind(tree, id, SYM_LOCAL, scope->locals[i].boxed, i);
+                if (!scope->locals[i].bound) tree->flags[id] |= AST_UNBOUND;
+                return;
+            }
+        }
+
+        i64 index = scope_capture(scope, sym);
+        if (index >= 0) {
+            sym_bind(tree, id, SYM_CAPTURED, scope->captures[index].boxed, index);
+            if (!scope->captures[index].bound) tree->flags[id] |= AST_UNBOUND;
+            return;
+        }
+    }
+
+    sym_bind(tree, id, SYM_GLOBAL, false, env_slot(globals, sym));
+}
+
+// The value is resolved first, it's evaluated before the local exists
+static void resolve_assign(AST_Tree* tree, AST_Id sym, AST_Id val, Scope* scope, Env* globals) {
+    resolve_ast(tree, val, scope, globals);
+
+    if (scope != NULL) {
+        for (u32 i = 0; i < scope->len; ++i) {
+            if (scope->locals[i].name == ast_sym(tree, sym)) {
+                scope->locals[i].bound = true;
+                scope->locals[i].maybe = true;
+            }
+        }
+    }
+
+    resolve_sym(tree, sym, scope, globals);
+}
+
+// (set 'sym val) becomes an AST_SET over the same children minus the
+// head, the head is left in the tree but nothing points at it anymore
+static void resolve_set(AST_Tree* tree, AST_Id id, Scope* scope, Env* globals) {
+    AST_Id* kids = ast_kids(tree, id);
+    AST_Id sym = kids[1];
+    AST_Id val = kids[2];
+
+    tree->flags[sym] &= ~AST_QUOTED;
+    tree->tags[id] = AST_SET;
+    tree->data[id].kids.start++;
+    tree->data[id].kids.len = 2;
+
+    resolve_assign(tree, sym, val, scope, globals);
+}
+
+static void resolve_fn(AST_Tree* tree, AST_Id id, Scope* parent, Env* globals) {
+    AST_Fn* fn = ast_fn(tree, id);
+    AST_Id* params = ast_kids(tree, fn->params);
+    Scope scope = {parent, NULL, 0, 0, NULL, 0, 0};
+
+    for (u32 i = 0; i < ast_len(tree, fn->params); ++i) {
+        u32 slot = scope_declare(&scope, ast_sym(tree, params[i]));
+        scope.locals[slot].bound = true;
+        scope.locals[slot].maybe = true;
+    }
+
+    AST_Id* body = &tree->kids[fn->body];
+    u32 body_len = fn->body_len;
+
+    bool heap_frame = false;
+    for (u32 i = 0; i < body_len; ++i) {
+        declare_locals(tree, body[i], &scope);
+        heap_frame |= needs_heap_frame(tree, body[i]);
+    }
+
+    // A closure gets a copy of what it captures, so a local that's set
+    // on either side and captured has to live in a box both of them share
+    u32 box_count = 0;
+    u32* boxes = malloc(sizeof(u32) * scope.len);
+    ASSERT(scope.len == 0 || boxes != NULL, "outta ram");
+
+    for (u32 i = 0; i < scope.len; ++i) {
+        bool used = false;
+        bool set = false;
+
+        for (u32 j = 0; j < body_len; ++j) {
+            captured(tree, body[j], scope.locals[i].name, false, &used, &set);
+        }
+
+        if (used && (set || scope.locals[i].assigned)) {
+            scope.locals[i].boxed = true;
+            boxes[box_count++] = i;
+        }
+    }
+
+    for (u32 i = 0; i < body_len; ++i) {
+        resolve_ast(tree, body[i], &scope, globals);
+    }
+
+    Capture* captures = malloc(sizeof(Capture) * scope.capture_len);
+    ASSERT(scope.capture_len == 0 || captures != NULL, "outta ram");
+
+    for (u32 i = 0; i < scope.capture_len; ++i) {
+        captures[i] = scope.captures[i].from;
+    }
+
+    fn->heap_frame = heap_frame;
+    fn->slot_count = scope.len;
+    fn->box_count = box_count;
+    fn->boxes = ast_add_boxes(tree, boxes, box_count);
+    fn->capture_count = scope.capture_len;
+    fn->captures = ast_add_captures(tree, captures, scope.capture_len);
+
+    free(boxes);
+    free(captures);
+    free(scope.locals);
+    free(scope.captures);
+}
+
+static void resolve_ast(AST_Tree* tree, AST_Id id, Scope* scope, Env* globals) {
+    if (!ast_is_eval(tree, id)) return;
+
+    switch (ast_tag(tree, id)) {
+        case AST_PROG:
+        case AST_LIST: {
+            if (is_literal_set(tree, id)) {
+                resolve_set(tree, id, scope, globals);
+                break;
+            }
+
+            AST_Id* kids = ast_kids(tree, id);
+            for (u32 i = 0; i < ast_len(tree, id); ++i) {
+                resolve_ast(tree, kids[i], scope, globals);
+            }
+            break;
+        }
+        case AST_FN: {
+            resolve_fn(tree, id, scope, globals);
+            break;
+        }
+        case AST_IF: {
+            AST_Id* kids = ast_kids(tree, id);
+            resolve_ast(tree, kids[0], scope, globals);
+
+            if (scope == NULL) {
+                resolve_ast(tree, kids[1], scope, globals);
+                resolve_ast(tree, kids[2], scope, globals);
+                break;
+            }
+
+            // Only one branch runs, what one of them sets is unbound in
+            // the other. After the if it's bound only if both set it,
+            // maybe bound if one did.
+            Local* other = malloc(sizeof(Local) * scope->len);
+            ASSERT(scope->len == 0 || other != NULL, "outta ram");
+            memcpy(other, scope->locals, sizeof(Local) * scope->len);
+
+            resolve_ast(tree, kids[1], scope, globals);
+
+            for (u32 i = 0; i < scope->len; ++i) {
+                Local then = scope->locals[i];
+                scope->locals[i] = other[i];
+                other[i] = then;
+            }
+
+            resolve_ast(tree, kids[2], scope, globals);
+
+            for (u32 i = 0; i < scope->len; ++i) {
+                scope->locals[i].bound &= other[i].bound;
+                scope->locals[i].maybe |= other[i].maybe;
+            }
+            free(other);
+            break;
+        }
+        case AST_SET: {
+            AST_Id* kids = ast_kids(tree, id);
+            resolve_assign(tree, kids[0], kids[1], scope, globals);
+            break;
+        }
+        case AST_SYM: {
+            resolve_sym(tree, id, scope, globals);
+            break;
+        }
+        case AST_NUMBER:
+        case AST_STR:
+        case AST_NIL:
+            break;
+    }
+}
+
+void resolve(AST_Tree* tree, AST_Id prog, Env* globals) {
+    resolve_ast(tree, prog, NULL, globals);
+}
@@ -0,0 +1,75 @@
+#include "include/source.h"
+#include <Pigeon/defines.h>
+#include <Pigeon/string.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Pipes, empty files and anything else mmap can't take are read into
+// the heap, their size isn't known up front
+static String source_read(int fd) {
+    usize cap = DATA_START_CAPACITY;
+    String text = {.data = malloc(cap), .len = 0};
+    ASSERT(text.data != NULL, "outta ram");
+
+    for (;;) {
+        if (text.len + 1 >= cap) {
+            cap *= 2;
+            text.data = realloc(text.data, cap);
+            ASSERT(text.data != NULL, "outta ram");
+        }
+
+        ssize_t n = read(fd, text.data + text.len, cap - text.len - 1);
+        if (n <= 0) break;
+        text.len += n;
+    }
+
+    text.data[text.len] = '\0';
+    return text;
+}
+
+Source source_open(String path) {
+    Source src = {string(""), false};
+
+    int fd = open(path.data, O_RDONLY);
+    if (fd < 0) {
+        perror(path.data);
+        exit(1);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        src.text = source_read(fd);
+        close(fd);
+        return src;
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        src.text = source_read(fd);
+        close(fd);
+        return src;
+    }
+
+    close(fd);
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    src.text.data = data;
+    src.text.len = st.st_size;
+    src.mapped = true;
+    return src;
+}
+
+void source_close(Source* src) {
+    if (src->mapped) {
+        munmap(src->text.data, src->text.len);
+    } else {
+        free(src->text.data);
+    }
+
+    src->text = string("");
+    src->mapped = false;
+}
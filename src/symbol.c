@@ -0,0 +1,131 @@
+#include "include/symbol.h"
+#include "include/value.h"
+#include "include/pool.h"
+#include <Pigeon/defines.h>
+#include <Pigeon/string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FX_SEED 0x517cc1b727220a95ULL
+
+static struct {
+    // Indexed by id
+    Symbol** at;
+    u32 len;
+    u32 cap;
+
+    // Open addressed table of id + 1, 0 marks an empty spot
+    u32* index;
+    u32 index_cap;
+} table;
+
+// FxHash, eight bytes at a time
+u64 string_hash(String str) {
+    u64 hash = 0;
+    usize i = 0;
+
+    for (; i + 8 <= str.len; i += 8) {
+        u64 word;
+        memcpy(&word, str.data + i, 8);
+        hash = (((hash << 5) | (hash >> 59)) ^ word) * FX_SEED;
+    }
+
+    if (i < str.len) {
+        u64 word = 0;
+        memcpy(&word, str.data + i, str.len - i);
+        hash = (((hash << 5) | (hash >> 59)) ^ word) * FX_SEED;
+    }
+
+    // The top bits are the best mixed ones
+    return hash ^ (hash >> 32);
+}
+
+static void symbol_table_grow() {
+    free(table.index);
+    table.index_cap = table.index_cap == 0 ? SYMBOL_INITIAL_CAP : table.index_cap * 2;
+    table.index = calloc(table.index_cap, sizeof(u32));
+    ASSERT(table.index != NULL, "outta ram");
+
+    u32 mask = table.index_cap - 1;
+    for (u32 i = 0; i < table.len; ++i) {
+        u32 pos = table.at[i]->hash & mask;
+        while (table.index[pos] != 0) {
+            pos = (pos + 1) & mask;
+        }
+        table.index[pos] = i + 1;
+    }
+}
+
+Symbol* symbol_intern(String name) {
+    u64 hash = string_hash(name);
+
+    if (table.index_cap != 0) {
+        u32 mask = table.index_cap - 1;
+        u32 pos = hash & mask;
+
+        while (table.index[pos] != 0) {
+            Symbol* sym = table.at[table.index[pos] - 1];
+            if (sym->hash == hash && string_eq(sym->name, name)) {
+                return sym;
+            }
+            pos = (pos + 1) & mask;
+        }
+    }
+
+    if ((table.len + 1) * 4 > table.index_cap * 3) {
+        symbol_table_grow();
+    }
+
+    if (table.len >= table.cap) {
+        table.cap = table.cap == 0 ? SYMBOL_INITIAL_CAP : table.cap * 2;
+        table.at = realloc(table.at, table.cap * sizeof(Symbol*));
+        ASSERT(table.at != NULL, "outta ram");
+    }
+
+    Symbol* sym = malloc(sizeof(Symbol));
+    sym->name = string_malloc(name.len);
+    memcpy(sym->name.data, name.data, name.len);
+    sym->hash = hash;
+    sym->id = table.len;
+    sym->value = value_alloc(VALUE_NEW(VALUE_SYM, sym), NULL);
+
+    table.at[table.len++] = sym;
+
+    u32 mask = table.index_cap - 1;
+    u32 pos = hash & mask;
+    while (table.index[pos] != 0) {
+        pos = (pos + 1) & mask;
+    }
+    table.index[pos] = table.len;
+
+    return sym;
+}
+
+Symbol* symbol_get(u32 id) {
+    ASSERT(id < table.len, "Unknown symbol id");
+    return table.at[id];
+}
+
+bool symbol_is_canonical(Value* val) {
+    return value_tag(val) == VALUE_SYM && VALUE_GET(val, VALUE_SYM)->value == val;
+}
+
+void symbol_print(Symbol* sym) {
+    printf("%.*s", (int)sym->name.len, sym->name.data);
+}
+
+void symbol_table_free() {
+    for (u32 i = 0; i < table.len; ++i) {
+        Symbol* sym = table.at[i];
+        string_free(&sym->name);
+        pool_free(POOL_VALUE, sym->value);
+        free(sym);
+    }
+
+    free(table.at);
+    free(table.index);
+    table.at = NULL;
+    table.index = NULL;
+    table.len = table.cap = table.index_cap = 0;
+}
@@ -1,30 +1,69 @@
 #include "include/value.h"
+#include "include/array.h"
 #include "include/ast.h"
 #include "include/env.h"
 #include "include/gc.h"
+#include "include/symbol.h"
+#include "include/pool.h"
+#include "include/vm.h"
 #include <Pigeon/string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
-Value_Vec* value_vec_new() {
-    Value_Vec* vec = malloc(sizeof(Value_Vec));
-    vec->at = malloc(sizeof(Value*) * 128);
-    vec->cap = 128;
+// Room for exactly cap items, most lists never grow after they're made.
+// An empty one doesn't allocate at all.
+Value_Vec* value_vec_new(usize cap) {
+    Value_Vec* vec = pool_alloc(POOL_VALUE_VEC);
+    vec->at = NULL;
+    vec->cap = cap;
     vec->len = 0;
+    vec->base = NULL;
+
+    if (cap > 0) {
+        vec->at = malloc(sizeof(Value*) * cap);
+        ASSERT(vec->at != NULL, "outta ram");
+    }
+    return vec;
+}
+
+// The items of list from start on, shared instead of copied
+Value_Vec* value_vec_slice(Value* list, usize start) {
+    Value_Vec* src = VALUE_GET(list, VALUE_LIST);
+    ASSERT(start <= src->len, "Slice out of range");
+
+    Value_Vec* vec = pool_alloc(POOL_VALUE_VEC);
+    vec->at = src->at + start;
+    vec->len = src->len - start;
+    vec->cap = 0;
+    vec->base = src->base ? src->base : list;
     return vec;
 }
 
 void value_vec_free(Value_Vec* vec) {
-    for (usize i = 0; i < vec->len; ++i) {
-        value_free(vec->at[i]);
+    if (vec->base == NULL) {
+        for (usize i = 0; i < vec->len; ++i) {
+            value_free(vec->at[i]);
+        }
+
+        free(vec->at);
     }
 
-    free(vec->at);
-    free(vec);
+    pool_free(POOL_VALUE_VEC, vec);
 }
 
 void value_vec_append(Value_Vec* vec, Value* item) {
+    if (vec->base != NULL) {
+        Value** at = malloc((vec->len + 1) * sizeof(Value*));
+        ASSERT(at != NULL, "outta ram");
+        memcpy(at, vec->at, vec->len * sizeof(Value*));
+
+        vec->at = at;
+        vec->cap = vec->len + 1;
+        vec->base = NULL;
+    }
+
     if (vec->len >= vec->cap) {
         vec->cap = vec->cap == 0 ? DATA_START_CAPACITY : vec->cap*2;
         vec->at = realloc(vec->at, vec->cap*sizeof(Value*));
@@ -33,45 +72,355 @@ void value_vec_append(Value_Vec* vec, Value* item) {
     vec->at[vec->len++] = (item);
 }
 
-Value* lambda_call(Lambda* lambda, Gc* parent_gc, Value_Vec* args) {
+// Appends to a list or vector that's already on the heap, the gc
+// hears about the item and about the buffer if it had to grow
+void value_push(Gc* gc, Value* coll, Value* item) {
+    Value_Vec* vec = VALUE_GET(coll, VALUE_LIST);
+    u64 cap = vec->cap;
+
+    value_vec_append(vec, item);
+    if (vec->cap > cap) {
+        gc_grow(gc, coll, (vec->cap - cap) * sizeof(Value*));
+    }
+
+    gc_write_barrier_value(gc, coll, item);
+}
+
+// Runs the body in the caller's heap, the result is handed back as is.
+// args has to be the top of the gc's shadow stack right above the
+// callee, the caller pops it along with the rest of the frame.
+// Calls in tail position reuse that spot, so a loop written as tail
+// recursion runs in constant C stack.
+Value* lambda_call(Lambda* lambda, Gc* gc, Value_Vec* args) {
     if (lambda->argc != args->len) {
-        return value_alloc(VALUE_NEW(VALUE_NIL, 0), parent_gc);
+        return WISP_NIL;
     }
 
-    Gc* gc = gc_new();
-    gc_set_mode(gc, REPL);
+    u64 base = args->at - gc->roots;
+
+    for (;;) {
+        Env* env;
+        Env frame = {0};
+
+        if (lambda->heap_frame) {
+            env = env_new_frame(lambda->env, lambda->slot_count);
+            gc_add_env(gc, env);
+
+            for (usize i = 0; i < lambda->argc; ++i) {
+                env->slots[i] = gc->roots[base + i];
+            }
+
+            env->captures = lambda->captures;
+            gc_push_scope(gc, env);
+        } else {
+            // Nothing can capture this frame, so it lives on the C stack and
+            // its slots are the args on the shadow stack plus room for locals.
+            // It's a scope like any other frame so a set with a computed name
+            // is still traced, but it's never remembered, it'd be gone by the
+            // time the next minor collection looked at it.
+            frame.parent = lambda->env;
+            frame.slots = &gc->roots[base];
+            frame.slot_count = lambda->slot_count;
+            frame.captures = lambda->captures;
+            frame.on_stack = true;
+            env = &frame;
+
+            // Locals are unbound until they're set
+            for (u32 i = lambda->argc; i < lambda->slot_count; ++i) {
+                gc_push_root(gc, NULL);
+            }
+
+            gc_push_scope(gc, env);
+        }
 
-    for (usize i = 0; i < args->len; ++i) {
-        env_insert(lambda->env, lambda->params[i], args->at[i]);
+        // Nothing can collect before the frame is filled in
+        for (u32 i = 0; i < lambda->box_count; ++i) {
+            Value** slot = &env->slots[lambda->boxes[i]];
+            *slot = value_alloc(VALUE_NEW(VALUE_BOX, *slot), gc);
+        }
+
+        AST_Tree* tree = lambda->tree;
+        AST_Fn* fn = ast_fn(tree, lambda->fn);
+        Value* v = WISP_NIL;
+        bool tail = false;
+
+        for (u32 i = 0; i < fn->body_len; ++i) {
+            AST_Id form = tree->kids[fn->body + i];
+            gc_maybe_collect(gc, env);
+
+            if (i + 1 < fn->body_len) {
+                v = ast_eval(tree, form, env, gc);
+            } else {
+                v = ast_eval_tail(tree, form, env, gc, &tail);
+            }
+        }
+
+        gc_pop_scope(gc);
+
+        if (!lambda->heap_frame) {
+            // Only there if something called set with a computed name
+            free(frame.data);
+            free(frame.index);
+        }
+
+        if (!tail) {
+            return v;
+        }
+
+        // The tail call left its callee and args on top of the shadow
+        // stack, slide them down over this frame and go again
+        lambda = VALUE_GET(v, VALUE_LAMBDA);
+        u64 from = gc->root_len - lambda->argc - 1;
+
+        memmove(&gc->roots[base - 1], &gc->roots[from], (lambda->argc + 1) * sizeof(Value*));
+        gc->root_len = base + lambda->argc;
+    }
+}
+
+// Everything the callee gets goes on the shadow stack first, it may
+// collect. Compiled lambdas run on the vm, the rest right here.
+Value* value_call(Gc* gc, Env* env, Value* callee, Value_Vec args) {
+    ValueTag tag = value_tag(callee);
+    if (tag != VALUE_NATIVE && tag != VALUE_LAMBDA) {
+        return WISP_NIL;
+    }
+
+    if (tag == VALUE_LAMBDA && VALUE_GET(callee, VALUE_LAMBDA)->chunk != NULL) {
+        ASSERT(gc->vm != NULL, "Compiled lambda called without a vm");
+        return vm_call(gc->vm, callee, args);
     }
 
-    Value* v = ast_eval(lambda->body, lambda->env, gc);
-    Value* ret_val = value_clone(v, parent_gc);
+    u64 base = gc_push_root(gc, callee);
+    for (usize i = 0; i < args.len; ++i) {
+        gc_push_root(gc, args.at[i]);
+    }
+
+    Value_Vec view = {&gc->roots[base + 1], args.len, args.len, NULL};
+    Value* v;
 
-    gc_free(gc);
+    if (tag == VALUE_NATIVE) {
+        v = VALUE_GET(callee, VALUE_NATIVE)(gc, env, view);
+    } else {
+        v = lambda_call(VALUE_GET(callee, VALUE_LAMBDA), gc, &view);
+    }
 
-    return ret_val;
+    gc_pop_roots(gc, base);
+    return v;
 }
 
-Value* value_alloc(Value val, Gc* gc) {
-    Value* v = malloc(sizeof(Value));
-    if (v) *v = val;
+Value* value_force(Gc* gc, Env* env, Value* promise) {
+    if (value_tag(promise) != VALUE_PROMISE) {
+        return promise;
+    }
 
+    if (!promise->val.VALUE_PROMISE.forced) {
+        u64 base = gc_push_root(gc, promise);
+        Value* v = value_call(gc, env, VALUE_GET(promise, VALUE_PROMISE), (Value_Vec){0});
+        promise = gc->roots[base];
+        gc_pop_roots(gc, base);
+
+        // The thunk may have forced it itself, the first value sticks
+        if (!promise->val.VALUE_PROMISE.forced) {
+            promise->val.VALUE_PROMISE.val = v;
+            promise->val.VALUE_PROMISE.forced = true;
+            gc_write_barrier_value(gc, promise, v);
+        }
+    }
+
+    return VALUE_GET(promise, VALUE_PROMISE);
+}
+
+bool value_iter_start(Value_Iter* it, Gc* gc, Env* env, Value* seq) {
+    it->gc = gc;
+    it->env = env;
+    it->root = gc_push_root(gc, seq);
+    it->index = 0;
+
+    switch (value_tag(seq)) {
+        case VALUE_LIST:
+        case VALUE_VECTOR:
+        case VALUE_RANGE:
+        case VALUE_SEQ:
+        case VALUE_ARRAY:
+        case VALUE_NIL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Lists and vectors are read in place, the list can't move out from
+// under it since only its Value is ever copied. A sequence's tail is
+// only forced once the item before it has been handed out.
+bool value_iter_next(Value_Iter* it, Value** item) {
+    for (;;) {
+        Value* seq = it->gc->roots[it->root];
+
+        switch (value_tag(seq)) {
+            case VALUE_LIST:
+            case VALUE_VECTOR: {
+                Value_Vec* vec = VALUE_GET(seq, VALUE_LIST);
+                if (it->index >= vec->len) {
+                    return false;
+                }
+
+                *item = vec->at[it->index++];
+                return true;
+            }
+            case VALUE_RANGE: {
+                Range r = VALUE_GET(seq, VALUE_RANGE);
+                if (it->index >= range_len(r)) {
+                    return false;
+                }
+
+                *item = value_int(r.start + (i64)it->index++ * r.step, it->gc);
+                return true;
+            }
+            case VALUE_ARRAY: {
+                Array* arr = VALUE_GET(seq, VALUE_ARRAY);
+                if (it->index >= arr->len) {
+                    return false;
+                }
+
+                *item = array_item(arr, it->index++, it->gc);
+                return true;
+            }
+            case VALUE_SEQ: {
+                if (it->index == 0) {
+                    it->index = 1;
+                    *item = VALUE_GET(seq, VALUE_SEQ);
+                    return true;
+                }
+
+                Value* rest = value_force(it->gc, it->env, seq->val.VALUE_SEQ.tail);
+                it->gc->roots[it->root] = rest;
+                it->index = 0;
+                break;
+            }
+            default: {
+                return false;
+            }
+        }
+    }
+}
+
+static Value* value_box(Value val, Gc* gc) {
     if (gc != NULL) {
-        gc_add_value(gc, v);
+        return gc_alloc(gc, val);
     }
 
+    Value* v = pool_alloc(POOL_VALUE);
+    *v = val;
     return v;
 }
 
+Value* value_int(i64 num, Gc* gc) {
+    if (num >= FIXNUM_MIN && num <= FIXNUM_MAX) {
+        return (Value*)(((uintptr_t)num << 1) | VALUE_FIXNUM_BIT);
+    }
+
+    return value_box(VALUE_NEW(VALUE_INTEGER, num), gc);
+}
+
+Value* value_real(f64 real, Gc* gc) {
+    u64 bits;
+    memcpy(&bits, &real, sizeof(f64));
+
+    if ((bits & VALUE_REAL_MASK) == 0) {
+        return (Value*)(bits | VALUE_REAL_BIT);
+    }
+
+    return value_box(VALUE_NEW(VALUE_REAL, real), gc);
+}
+
+// Integers, reals and nil come back as immediates when they fit
+Value* value_alloc(Value val, Gc* gc) {
+    switch (val.tag) {
+        case VALUE_INTEGER: return value_int(val.val.VALUE_INTEGER.val, gc);
+        case VALUE_REAL:    return value_real(val.val.VALUE_REAL.val, gc);
+        case VALUE_NIL:     return WISP_NIL;
+        default: break;
+    }
+
+    return value_box(val, gc);
+}
+
+// The items of anything that can be walked, a space before each one
+// but the first. Returns whether nothing has been printed yet.
+static bool print_items(Value* val, bool first) {
+    switch (value_tag(val)) {
+        case VALUE_LIST:
+        case VALUE_VECTOR: {
+            Value_Vec* vec = VALUE_GET(val, VALUE_LIST);
+            for (usize i = 0; i < vec->len; ++i) {
+                if (!first) printf(" ");
+                value_print(vec->at[i]);
+                first = false;
+            }
+            return first;
+        }
+        case VALUE_RANGE: {
+            Range r = VALUE_GET(val, VALUE_RANGE);
+            u64 len = range_len(r);
+
+            for (u64 i = 0; i < len; ++i) {
+                if (!first) printf(" ");
+                printf("%ld", r.start + (i64)i * r.step);
+                first = false;
+            }
+            return first;
+        }
+        case VALUE_ARRAY: {
+            Array* arr = VALUE_GET(val, VALUE_ARRAY);
+            for (u64 i = 0; i < arr->len; ++i) {
+                if (!first) printf(" ");
+                if (arr->kind == ARRAY_I64) {
+                    printf("%ld", arr->at.ints[i]);
+                } else {
+                    printf("%f", arr->at.reals[i]);
+                }
+                first = false;
+            }
+            return first;
+        }
+        case VALUE_SEQ: {
+            // Only what's been forced so far, the rest may never end
+            while (value_tag(val) == VALUE_SEQ) {
+                if (!first) printf(" ");
+                value_print(VALUE_GET(val, VALUE_SEQ));
+                first = false;
+
+                Value* tail = val->val.VALUE_SEQ.tail;
+                if (value_tag(tail) == VALUE_PROMISE) {
+                    if (!tail->val.VALUE_PROMISE.forced) {
+                        printf(" ...");
+                        return first;
+                    }
+                    tail = VALUE_GET(tail, VALUE_PROMISE);
+                }
+                val = tail;
+            }
+            return print_items(val, first);
+        }
+        case VALUE_NIL: {
+            return first;
+        }
+        default: {
+            printf(" . ");
+            value_print(val);
+            return false;
+        }
+    }
+}
+
 void value_print(Value* val) {
-    switch (val->tag) {
+    switch (value_tag(val)) {
         case VALUE_INTEGER: {
-            printf("%ld", VALUE_GET(val, VALUE_INTEGER));
+            printf("%ld", value_as_int(val));
             break;
         }
         case VALUE_REAL: {
-            printf("%f", VALUE_GET(val, VALUE_REAL));
+            printf("%f", value_as_real(val));
             break;
         }
         case VALUE_STR: {
@@ -79,7 +428,7 @@ void value_print(Value* val) {
             break;
         }
         case VALUE_SYM: {
-            string_print(VALUE_GET(val, VALUE_SYM));
+            symbol_print(VALUE_GET(val, VALUE_SYM));
             break;
         }
         case VALUE_NIL: {
@@ -93,17 +442,23 @@ void value_print(Value* val) {
             printf(")");
             break;
         }
-        case VALUE_LIST: {
-            Value_Vec* list = VALUE_GET(val, VALUE_LIST);
+        case VALUE_LIST:
+        case VALUE_RANGE:
+        case VALUE_SEQ: {
             printf("(");
-            for (usize i = 0; i < list->len; ++i) {
-                value_print(list->at[i]);
-
-                if (i + 1 < list->len) {
-                    printf(" ");
-                }
-            }
-
+            print_items(val, true);
+            printf(")");
+            break;
+        }
+        case VALUE_VECTOR: {
+            printf("[");
+            print_items(val, true);
+            printf("]");
+            break;
+        }
+        case VALUE_ARRAY: {
+            printf(VALUE_GET(val, VALUE_ARRAY)->kind == ARRAY_I64 ? "#i64(" : "#f64(");
+            print_items(val, true);
             printf(")");
             break;
         }
@@ -116,166 +471,189 @@ void value_print(Value* val) {
             printf("(Lambda) @ %p", (void*)&VALUE_GET(val, VALUE_LAMBDA));
             break;
         }
+
+        case VALUE_BOX: {
+            printf("(Box ");
+            value_print(VALUE_GET(val, VALUE_BOX));
+            printf(")");
+            break;
+        }
+
+        case VALUE_XFORM: {
+            static const char* names[] = {"map", "filter", "take"};
+            Value_Vec* stages = VALUE_GET(val, VALUE_XFORM);
+
+            printf("(Xform");
+            for (usize i = 0; i < stages->len; i += 2) {
+                printf(" %s", names[value_as_int(stages->at[i])]);
+            }
+            printf(")");
+            break;
+        }
+
+        case VALUE_PROMISE: {
+            if (!val->val.VALUE_PROMISE.forced) {
+                printf("(Promise ...)");
+                break;
+            }
+
+            printf("(Promise ");
+            value_print(VALUE_GET(val, VALUE_PROMISE));
+            printf(")");
+            break;
+        }
     }
 }
 
-void value_free(Value* val) {
+// Frees what a value owns but not the value itself, values in the
+// gc's nursery are never passed to free
+void value_drop(Value* val) {
     switch (val->tag) {
         case VALUE_ERR:
             string_free(&val->val.VALUE_ERR.val.msg);
-            goto __value_free;
-        case VALUE_SYM:
-            string_free(&val->val.VALUE_SYM.val);
-            goto __value_free;
+            return;
         case VALUE_STR:
             string_free(&val->val.VALUE_STR.val);
-            goto __value_free;
-
-        case VALUE_NIL:
-        case VALUE_INTEGER:
-        case VALUE_NATIVE:
-        case VALUE_REAL:
-            goto __value_free;
+            return;
 
-        case VALUE_LIST: {
+        case VALUE_LIST:
+        case VALUE_VECTOR:
+        case VALUE_XFORM: {
             Value_Vec* vec = VALUE_GET(val, VALUE_LIST);
 
             // for (usize i = 0; i < vec->len; ++i) {
             //     value_free(vec->at[i]);
             // }
 
-            free(vec->at);
-            free(vec);
+            // A slice's items belong to its base
+            if (vec->base == NULL) {
+                free(vec->at);
+            }
+            pool_free(POOL_VALUE_VEC, vec);
+            return;
+        }
 
-            goto __value_free;
+        case VALUE_ARRAY: {
+            array_free(VALUE_GET(val, VALUE_ARRAY));
+            return;
         }
 
         case VALUE_LAMBDA: {
             Lambda* lambda = VALUE_GET(val, VALUE_LAMBDA);
 
-            ast_free(lambda->body);
-            
-            for (usize i = 0; i < lambda->argc; ++i) {
-                string_free(&lambda->params[i]);
+            // The code is shared and the env belongs to the gc,
+            // other closures may still point at them
+            if (lambda->chunk != NULL) {
+                lambda->chunk->top->refs--;
+            } else {
+                lambda->tree->refs--;
             }
 
-            free(lambda->params);
-            env_free(lambda->env);
-            free(lambda);
-
-            goto __value_free;
+            free(lambda->captures);
+            pool_free(POOL_LAMBDA, lambda);
+            return;
         }
 
+        default: return;
     }
+}
 
-__value_free:
-    free(val);
-    return;
+void value_free(Value* val) {
+    if (!value_is_heap(val)) return;
+
+    // The symbol table owns this one
+    if (symbol_is_canonical(val)) return;
+
+    value_drop(val);
+    pool_free(POOL_VALUE, val);
 }
 
+// Marked values are skipped, closures can reach themselves through their env
 void value_mark(Value* val) {
-    switch (val->tag) {
-        case VALUE_LAMBDA:
-        case VALUE_SYM:
-        case VALUE_STR:
-        case VALUE_NIL:
-        case VALUE_INTEGER:
-        case VALUE_NATIVE:
-        case VALUE_REAL:
-        case VALUE_ERR:
-            val->marked = true;
-            return;
+    // A promise or a sequence's tail is followed in a loop, a forced
+    // lazy sequence can be longer than the C stack is deep
+    while (value_is_heap(val) && !val->marked) {
+        val->marked = true;
+
+        switch (val->tag) {
+            case VALUE_LIST:
+            case VALUE_VECTOR:
+            case VALUE_XFORM: {
+                Value_Vec *vec = VALUE_GET(val, VALUE_LIST);
+                if (vec->base) value_mark(vec->base);
+
+                for (usize i = 0; i < vec->len; ++i) {
+                    value_mark(vec->at[i]);
+                }
+                return; 
+            }
+            case VALUE_LAMBDA: {
+                Lambda* lambda = VALUE_GET(val, VALUE_LAMBDA);
+                env_mark(lambda->env);
 
-        case VALUE_LIST: {
-            Value_Vec *vec = VALUE_GET(val, VALUE_LIST);
-            for (usize i = 0; i < vec->len; ++i) {
-                value_mark(vec->at[i]);
+                for (u32 i = 0; i < lambda->capture_count; ++i) {
+                    if (lambda->captures[i]) value_mark(lambda->captures[i]);
+                }
+                return;
             }
-            val->marked = true;
-            return; 
+            case VALUE_BOX: {
+                if (VALUE_GET(val, VALUE_BOX)) value_mark(VALUE_GET(val, VALUE_BOX));
+                return;
+            }
+            case VALUE_PROMISE: {
+                val = VALUE_GET(val, VALUE_PROMISE);
+                break;
+            }
+            case VALUE_SEQ: {
+                value_mark(VALUE_GET(val, VALUE_SEQ));
+                val = val->val.VALUE_SEQ.tail;
+                break;
+            }
+            default: return;
         }
     }
 }
 
 void value_unmark(Value* val) {
-    switch (val->tag) {
-        case VALUE_LAMBDA:
-        case VALUE_SYM:
-        case VALUE_STR:
-        case VALUE_NIL:
-        case VALUE_INTEGER:
-        case VALUE_NATIVE:
-        case VALUE_REAL:
-        case VALUE_ERR:
-            val->marked = false;
-            return;
-
-        case VALUE_LIST: {
-            Value_Vec* vec = VALUE_GET(val, VALUE_LIST);
-            for (usize i = 0; i < vec->len; ++i) {
-                value_unmark(vec->at[i]);
-            } 
-            val->marked = false;
-        }
-    }
-}
-
-// Investigate this function
-Value* value_clone(Value* val, Gc* gc) {
-    switch (val->tag) {
-        case VALUE_NATIVE:
-        case VALUE_NIL:
-        case VALUE_INTEGER:
-        case VALUE_REAL:
-            return value_alloc(*val, gc);
-
-        case VALUE_ERR: {
-            String old_msg = VALUE_GET(val, VALUE_ERR).msg;
-            String new_msg = string_clone_malloc(old_msg);
-            return value_alloc(VALUE_NEW(VALUE_ERR, {ERR, new_msg}), gc);
-        }
-
-        case VALUE_STR: {
-            String old_str = VALUE_GET(val, VALUE_STR);
-            String new_str = string_clone_malloc(old_str);
-            return value_alloc(VALUE_NEW(VALUE_STR, new_str), gc);
-        }
-            
-        case VALUE_SYM: {
-            String old_sym = VALUE_GET(val, VALUE_SYM);
-            String new_sym = string_clone_malloc(old_sym);
-            return value_alloc(VALUE_NEW(VALUE_SYM, new_sym), gc);
-        }
-
-        case VALUE_LIST: {
-            Value_Vec* old_vec = VALUE_GET(val, VALUE_LIST);
-            Value_Vec* new_vec = value_vec_new();
-
-            for (usize i = 0; i < old_vec->len; ++i) {
-                Value* v = value_clone(old_vec->at[i], gc);
-                value_vec_append(new_vec, v);
+    // Same walk as value_mark
+    while (value_is_heap(val) && val->marked) {
+        val->marked = false;
+
+        switch (val->tag) {
+            case VALUE_LIST:
+            case VALUE_VECTOR:
+            case VALUE_XFORM: {
+                Value_Vec* vec = VALUE_GET(val, VALUE_LIST);
+                if (vec->base) value_unmark(vec->base);
+
+                for (usize i = 0; i < vec->len; ++i) {
+                    value_unmark(vec->at[i]);
+                } 
+                return;
             }
+            case VALUE_LAMBDA: {
+                Lambda* lambda = VALUE_GET(val, VALUE_LAMBDA);
+                env_unmark(lambda->env);
 
-            return value_alloc(VALUE_NEW(VALUE_LIST, new_vec), gc);
-        }
-
-        case VALUE_LAMBDA: {
-            Lambda* old_lambda = VALUE_GET(val, VALUE_LAMBDA);
-            Lambda* new_lambda = calloc(1, sizeof(Lambda));
-            *new_lambda = *old_lambda;
-            new_lambda->argc = old_lambda->argc,
-            new_lambda->params = calloc(1, sizeof(String) * old_lambda->argc);
-
-            for (usize i = 0; i < old_lambda->argc; ++i) {
-                new_lambda->params[i] = string_clone_malloc(old_lambda->params[i]);
+                for (u32 i = 0; i < lambda->capture_count; ++i) {
+                    if (lambda->captures[i]) value_unmark(lambda->captures[i]);
+                }
+                return;
             }
-
-            new_lambda->body = ast_clone(old_lambda->body);
-            
-            return value_alloc(VALUE_NEW(VALUE_LAMBDA, new_lambda), gc);
+            case VALUE_BOX: {
+                if (VALUE_GET(val, VALUE_BOX)) value_unmark(VALUE_GET(val, VALUE_BOX));
+                return;
+            }
+            case VALUE_PROMISE: {
+                val = VALUE_GET(val, VALUE_PROMISE);
+                break;
+            }
+            case VALUE_SEQ: {
+                value_unmark(VALUE_GET(val, VALUE_SEQ));
+                val = val->val.VALUE_SEQ.tail;
+                break;
+            }
+            default: return;
         }
     }
-
-    // Let's not reach this one either, okay?
-    return value_alloc(VALUE_NEW(VALUE_NIL, 0), gc);
 }
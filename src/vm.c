@@ -0,0 +1,404 @@
+#include "include/vm.h"
+#include "include/chunk.h"
+#include "include/env.h"
+#include "include/gc.h"
+#include "include/value.h"
+#include "include/pool.h"
+#include <Pigeon/defines.h>
+#include <Pigeon/string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define READ_U16(ip) ((ip) += 2, (u16)((ip)[-2] | ((ip)[-1] << 8)))
+#define READ_U32(ip) ((ip) += 4, (u32)(ip)[-4] | ((u32)(ip)[-3] << 8) | ((u32)(ip)[-2] << 16) | ((u32)(ip)[-1] << 24))
+
+Vm* vm_new(Env* env, Gc* gc) {
+    Vm* vm = calloc(1, sizeof(Vm));
+    vm->env = env;
+    vm->gc = gc;
+    vm->stack = malloc(VM_STACK_MAX * sizeof(Value*));
+    ASSERT(vm->stack != NULL, "outta ram");
+    gc_set_stack(gc, vm->stack, &vm->sp);
+    gc->vm = vm;
+    return vm;
+}
+
+void vm_free(Vm* vm) {
+    for (usize i = 0; i < vm->chunks.len; ++i) {
+        chunk_free(vm->chunks.at[i]);
+    }
+
+    free(vm->chunks.at);
+    free(vm->frames);
+    free(vm->stack);
+    free(vm);
+}
+
+static void vm_push(Vm* vm, Value* val) {
+    ASSERT(vm->sp < VM_STACK_MAX, "Stack overflow");
+    vm->stack[vm->sp++] = val;
+}
+
+static Value* vm_pop(Vm* vm) {
+    return vm->stack[--vm->sp];
+}
+
+static CallFrame* vm_next_frame(Vm* vm) {
+    if (vm->frame_count >= vm->frame_cap) {
+        vm->frame_cap = vm->frame_cap == 0 ? DATA_START_CAPACITY : vm->frame_cap * 2;
+        vm->frames = realloc(vm->frames, vm->frame_cap * sizeof(CallFrame));
+        ASSERT(vm->frames != NULL, "outta ram");
+    }
+
+    return &vm->frames[vm->frame_count++];
+}
+
+static CallFrame* vm_push_frame(Vm* vm, Chunk* chunk, usize base) {
+    CallFrame* frame = vm_next_frame(vm);
+    frame->chunk = chunk;
+    frame->ip = chunk->code;
+    frame->slots = NULL;
+    frame->scope = NULL;
+    frame->captures = NULL;
+    frame->up = NULL;
+    frame->base = base;
+    return frame;
+}
+
+// The env natives, dynamic lookups and new closures see
+static Env* vm_frame_env(CallFrame* frame) {
+    return frame->scope ? frame->scope : frame->up;
+}
+
+// Natives and lambdas called with the wrong number of args don't need
+// a frame, their result replaces the callee and args right away.
+// Returns false for a lambda that has to be entered.
+static bool vm_call_direct(Vm* vm, CallFrame* frame, Value* callee, usize base, u32 argc) {
+    if (value_tag(callee) == VALUE_NATIVE) {
+        Value_Vec args = {&vm->stack[base + 1], argc, argc, NULL};
+        Value* v = VALUE_GET(callee, VALUE_NATIVE)(vm->gc, vm_frame_env(frame), args);
+
+        vm->sp = base;
+        vm_push(vm, v);
+        return true;
+    }
+
+    ASSERT(value_tag(callee) == VALUE_LAMBDA, "First symbol must be a function");
+
+    if (VALUE_GET(callee, VALUE_LAMBDA)->argc != argc) {
+        vm->sp = base;
+        vm_push(vm, WISP_NIL);
+        return true;
+    }
+
+    return false;
+}
+
+// Sets frame up to run lambda, its callee slot is at base and the
+// args right above it
+static void vm_enter(Vm* vm, CallFrame* frame, Lambda* lambda, usize base) {
+    frame->chunk = lambda->chunk;
+    frame->ip = lambda->chunk->code;
+    frame->captures = lambda->captures;
+    frame->up = lambda->env;
+    frame->base = base;
+
+    if (lambda->heap_frame) {
+        // A new env is remembered, no barrier needed
+        Env* scope = env_new_frame(lambda->env, lambda->slot_count);
+        scope->captures = lambda->captures;
+        gc_add_env(vm->gc, scope);
+        gc_push_scope(vm->gc, scope);
+
+        for (usize i = 0; i < lambda->argc; ++i) {
+            scope->slots[i] = vm->stack[base + 1 + i];
+        }
+
+        frame->scope = scope;
+        frame->slots = scope->slots;
+    } else {
+        // Args are already in place, locals go right after them and
+        // are unbound until they're set
+        frame->scope = NULL;
+        frame->slots = &vm->stack[base + 1];
+        for (u32 i = lambda->argc; i < lambda->slot_count; ++i) {
+            vm_push(vm, NULL);
+        }
+    }
+
+    for (u32 i = 0; i < lambda->box_count; ++i) {
+        Value** slot = &frame->slots[lambda->boxes[i]];
+        *slot = value_alloc(VALUE_NEW(VALUE_BOX, *slot), vm->gc);
+    }
+}
+
+static Value* vm_make_closure(Vm* vm, Chunk* proto, CallFrame* frame) {
+    Lambda* lambda = pool_calloc(POOL_LAMBDA);
+    proto->top->refs++;
+    lambda->argc = proto->argc;
+    lambda->chunk = proto;
+    lambda->env = vm_frame_env(frame);
+    lambda->slot_count = proto->slot_count;
+    lambda->heap_frame = proto->heap_frame;
+    lambda->boxes = proto->boxes;
+    lambda->box_count = proto->box_count;
+
+    lambda->capture_count = proto->capture_count;
+    lambda->captures = malloc(sizeof(Value*) * proto->capture_count);
+    ASSERT(proto->capture_count == 0 || lambda->captures != NULL, "outta ram");
+
+    for (u32 i = 0; i < proto->capture_count; ++i) {
+        Capture c = proto->captures[i];
+        lambda->captures[i] = c.local ? frame->slots[c.index] : frame->captures[c.index];
+    }
+
+    return value_alloc(VALUE_NEW(VALUE_LAMBDA, lambda), vm->gc);
+}
+
+// Runs frames until the one on top when we were entered returns
+static Value* vm_loop(Vm* vm) {
+    usize entry_depth = vm->frame_count - 1;
+    CallFrame* frame = &vm->frames[vm->frame_count - 1];
+    u8* ip = frame->ip;
+
+    for (;;) {
+        switch ((OpCode)*ip++) {
+            case OP_CONST: {
+                u16 idx = READ_U16(ip);
+                vm_push(vm, frame->chunk->consts.at[idx]);
+                break;
+            }
+            case OP_CONST_LONG: {
+                u32 idx = READ_U32(ip);
+                vm_push(vm, frame->chunk->consts.at[idx]);
+                break;
+            }
+            case OP_NIL: {
+                vm_push(vm, WISP_NIL);
+                break;
+            }
+            case OP_GET_VAR: {
+                Symbol* sym = VALUE_GET(frame->chunk->consts.at[READ_U32(ip)], VALUE_SYM);
+                Value* val = env_get(vm_frame_env(frame), sym).val;
+                vm_push(vm, val ? val : WISP_NIL);
+                break;
+            }
+            case OP_GET_LOCAL: {
+                Value* val = frame->slots[READ_U16(ip)];
+                vm_push(vm, val ? val : WISP_NIL);
+                break;
+            }
+            case OP_GET_LOCAL_OR: {
+                Value* val = frame->slots[READ_U16(ip)];
+                Symbol* sym = VALUE_GET(frame->chunk->consts.at[READ_U32(ip)], VALUE_SYM);
+
+                if (val == NULL) val = env_get(vm_frame_env(frame), sym).val;
+                vm_push(vm, val ? val : WISP_NIL);
+                break;
+            }
+            case OP_SET_LOCAL: {
+                u16 slot = READ_U16(ip);
+                Value* val = vm_pop(vm);
+
+                frame->slots[slot] = val;
+                if (frame->scope) gc_write_barrier(vm->gc, frame->scope, val);
+                break;
+            }
+            case OP_SET_BOXED: {
+                Value* box = frame->slots[READ_U16(ip)];
+                Value* val = vm_pop(vm);
+
+                box->val.VALUE_BOX.val = val;
+                gc_write_barrier_value(vm->gc, box, val);
+                break;
+            }
+            case OP_GET_CAPTURE: {
+                Value* val = frame->captures[READ_U16(ip)];
+                vm_push(vm, val ? val : WISP_NIL);
+                break;
+            }
+            case OP_SET_CAPTURE: {
+                Value* box = frame->captures[READ_U16(ip)];
+                Value* val = vm_pop(vm);
+
+                box->val.VALUE_BOX.val = val;
+                gc_write_barrier_value(vm->gc, box, val);
+                break;
+            }
+            case OP_UNBOX: {
+                Value* val = VALUE_GET(vm->stack[vm->sp - 1], VALUE_BOX);
+                vm->stack[vm->sp - 1] = val ? val : WISP_NIL;
+                break;
+            }
+            case OP_UNBOX_OR: {
+                Symbol* sym = VALUE_GET(frame->chunk->consts.at[READ_U32(ip)], VALUE_SYM);
+                Value* val = VALUE_GET(vm->stack[vm->sp - 1], VALUE_BOX);
+
+                if (val == NULL) val = env_get(vm_frame_env(frame), sym).val;
+                vm->stack[vm->sp - 1] = val ? val : WISP_NIL;
+                break;
+            }
+            case OP_GET_GLOBAL:
+            case OP_GET_GLOBAL_LONG: {
+                u32 index = ip[-1] == OP_GET_GLOBAL ? READ_U16(ip) : READ_U32(ip);
+                Bucket* bucket = &vm->env->data[index];
+
+                if (bucket->val != NULL) {
+                    vm_push(vm, bucket->val);
+                    break;
+                }
+
+                // Unbound globals can still come from a set with a computed name
+                Value* val = env_get(vm_frame_env(frame), bucket->ident).val;
+                vm_push(vm, val ? val : WISP_NIL);
+                break;
+            }
+            case OP_SET_GLOBAL:
+            case OP_SET_GLOBAL_LONG: {
+                u32 index = ip[-1] == OP_SET_GLOBAL ? READ_U16(ip) : READ_U32(ip);
+                vm->env->data[index].val = vm_pop(vm);
+                break;
+            }
+            case OP_POP: {
+                vm_pop(vm);
+                break;
+            }
+            case OP_CALL:
+            case OP_CALL_LONG: {
+                u32 argc = ip[-1] == OP_CALL ? *ip++ : READ_U32(ip);
+                usize base = vm->sp - argc - 1;
+
+                // Everything live is on the stack or in an env here,
+                // values may move so nothing is read before this
+                gc_maybe_collect(vm->gc, vm->env);
+                Value* callee = vm->stack[base];
+
+                // A native may have called back in and grown the frames
+                if (vm_call_direct(vm, frame, callee, base, argc)) {
+                    frame = &vm->frames[vm->frame_count - 1];
+                    break;
+                }
+
+                Lambda* lambda = VALUE_GET(callee, VALUE_LAMBDA);
+                frame->ip = ip;
+                frame = vm_next_frame(vm);
+                vm_enter(vm, frame, lambda, base);
+                ip = frame->ip;
+                break;
+            }
+            case OP_TAIL_CALL:
+            case OP_TAIL_CALL_LONG: {
+                u32 argc = ip[-1] == OP_TAIL_CALL ? *ip++ : READ_U32(ip);
+                usize base = vm->sp - argc - 1;
+
+                gc_maybe_collect(vm->gc, vm->env);
+                Value* callee = vm->stack[base];
+
+                // The OP_RETURN after this one hands their result back
+                if (vm_call_direct(vm, frame, callee, base, argc)) {
+                    frame = &vm->frames[vm->frame_count - 1];
+                    break;
+                }
+
+                if (frame->scope != NULL) {
+                    gc_pop_scope(vm->gc);
+                }
+
+                // The callee and its args take the place of this frame
+                memmove(&vm->stack[frame->base], &vm->stack[base], (argc + 1) * sizeof(Value*));
+                vm->sp = frame->base + argc + 1;
+
+                vm_enter(vm, frame, VALUE_GET(callee, VALUE_LAMBDA), frame->base);
+                ip = frame->ip;
+                break;
+            }
+            case OP_CLOSURE: {
+                Chunk* proto = frame->chunk->protos.at[READ_U16(ip)];
+                ASSERT(vm_frame_env(frame) != NULL, "Closure made in a frame without an env");
+                vm_push(vm, vm_make_closure(vm, proto, frame));
+                break;
+            }
+            case OP_JUMP: {
+                u32 offset = READ_U32(ip);
+                ip += offset;
+                break;
+            }
+            case OP_JUMP_IF_NIL: {
+                u32 offset = READ_U32(ip);
+                if (vm_pop(vm) == WISP_NIL) {
+                    ip += offset;
+                }
+                break;
+            }
+            case OP_RETURN: {
+                Value* result = vm_pop(vm);
+                vm->sp = frame->base;
+                vm->frame_count--;
+
+                if (frame->scope != NULL && frame->scope != vm->env) {
+                    gc_pop_scope(vm->gc);
+                }
+
+                if (vm->frame_count == entry_depth) {
+                    return result;
+                }
+
+                vm_push(vm, result);
+                frame = &vm->frames[vm->frame_count - 1];
+                ip = frame->ip;
+                break;
+            }
+        }
+    }
+}
+
+// Releases the kept chunks the gc has freed the last closure of
+static void vm_release_chunks(Vm* vm) {
+    usize live = 0;
+    for (usize i = 0; i < vm->chunks.len; ++i) {
+        if (vm->chunks.at[i]->refs == 0) {
+            chunk_release(vm->chunks.at[i], vm->gc);
+        } else {
+            vm->chunks.at[live++] = vm->chunks.at[i];
+        }
+    }
+    vm->chunks.len = live;
+}
+
+// The chunk is released once it has run, unless a closure made from
+// one of its fns is still around
+Value* vm_run(Vm* vm, Chunk* chunk) {
+    vm_release_chunks(vm);
+
+    CallFrame* frame = vm_push_frame(vm, chunk, vm->sp);
+    frame->scope = vm->env;
+    Value* result = vm_loop(vm);
+
+    if (chunk->refs == 0) {
+        chunk_release(chunk, vm->gc);
+    } else {
+        chunk_vec_append(&vm->chunks, chunk);
+    }
+
+    return result;
+}
+
+// For natives calling back into a lambda. It runs on top of whatever
+// frame called the native, vm_loop comes back once it returns.
+Value* vm_call(Vm* vm, Value* callee, Value_Vec args) {
+    Lambda* lambda = VALUE_GET(callee, VALUE_LAMBDA);
+    if (lambda->argc != args.len) {
+        return WISP_NIL;
+    }
+
+    usize base = vm->sp;
+    vm_push(vm, callee);
+    for (usize i = 0; i < args.len; ++i) {
+        vm_push(vm, args.at[i]);
+    }
+
+    CallFrame* frame = vm_next_frame(vm);
+    vm_enter(vm, frame, lambda, base);
+    return vm_loop(vm);
+}
@@ -12,8 +12,84 @@
 #include "include/ast.h"
 #include "include/parser.h"
 #include "include/lexer.h"
+#include "include/compiler.h"
+#include "include/resolver.h"
+#include "include/vm.h"
+#include "include/symbol.h"
+#include "include/pool.h"
+#include "include/source.h"
+
+// Runs a parsed program either through the bytecode vm or,
+// with --walk, through the ast_eval tree walker
+static Value* eval_prog(AST_Tree* tree, AST_Id prog, Vm* vm, Env* env, Gc* gc) {
+    resolve(tree, prog, env);
+
+    if (vm == NULL) {
+        return ast_eval(tree, prog, env, gc);
+    }
+
+    return vm_run(vm, compile(tree, prog));
+}
+
+// Same for one top level form of a script
+static void eval_form(AST_Tree* tree, AST_Id form, Vm* vm, Env* env, Gc* gc) {
+    resolve(tree, form, env);
+    gc_maybe_collect(gc, env);
+
+    if (vm == NULL) {
+        ast_eval(tree, form, env, gc);
+        return;
+    }
+
+    vm_run(vm, compile_form(tree, form));
+}
+
+// Parsed code the tree walker's lambdas point into, it has to
+// outlive every closure made from it
+typedef struct tree_vec_t {
+    AST_Tree** at;
+    usize len;
+    usize cap;
+} Tree_Vec;
+
+// Frees the tree unless a closure made from it is still around, along
+// with the kept trees the gc has freed the last closure of
+static void release_ast(Tree_Vec* kept, AST_Tree* tree) {
+    usize live = 0;
+    for (usize i = 0; i < kept->len; ++i) {
+        if (kept->at[i]->refs == 0) {
+            ast_tree_free(kept->at[i]);
+        } else {
+            kept->at[live++] = kept->at[i];
+        }
+    }
+    kept->len = live;
+
+    if (tree->refs == 0) {
+        ast_tree_free(tree);
+        return;
+    }
+
+    if (kept->len >= kept->cap) {
+        kept->cap = kept->cap == 0 ? DATA_START_CAPACITY : kept->cap * 2;
+        kept->at = realloc(kept->at, kept->cap * sizeof(AST_Tree*));
+        ASSERT(kept->at != NULL, "outta ram");
+    }
+    kept->at[kept->len++] = tree;
+}
 
 i32 main(i32 argc, char** argv) {
+    char* file_arg = NULL;
+    bool walk = false;
+
+    for (i32 i = 1; i < argc; ++i) {
+        if (string_eq(string(argv[i]), string("--walk"))) {
+            walk = true;
+        } else {
+            file_arg = argv[i];
+        }
+    }
+
     Arena* arena = arena_new();
     String line = string("");
 
@@ -21,63 +97,87 @@ i32 main(i32 argc, char** argv) {
     Parser* parser;
 
     Env* env = env_new(NULL);
-    env_insert(env, string("+"),       &VALUE_NEW(VALUE_NATIVE, wisp_add));
-    env_insert(env, string("-"),       &VALUE_NEW(VALUE_NATIVE, wisp_sub));
-    env_insert(env, string("*"),       &VALUE_NEW(VALUE_NATIVE, wisp_mul));
-    env_insert(env, string("/"),       &VALUE_NEW(VALUE_NATIVE, wisp_div));
-    env_insert(env, string("="),       &VALUE_NEW(VALUE_NATIVE, wisp_eq));
-    env_insert(env, string("/="),      &VALUE_NEW(VALUE_NATIVE, wisp_neq));
-    env_insert(env, string("<"),       &VALUE_NEW(VALUE_NATIVE, wisp_lt));
-    env_insert(env, string("<="),      &VALUE_NEW(VALUE_NATIVE, wisp_lte));
-    env_insert(env, string(">"),       &VALUE_NEW(VALUE_NATIVE, wisp_gt));
-    env_insert(env, string(">="),      &VALUE_NEW(VALUE_NATIVE, wisp_gte));
-    env_insert(env, string("hello"),   &VALUE_NEW(VALUE_NATIVE, wisp_hello));
-    env_insert(env, string("print"),   &VALUE_NEW(VALUE_NATIVE, wisp_print));
-    env_insert(env, string("println"), &VALUE_NEW(VALUE_NATIVE, wisp_println));
-    env_insert(env, string("set"),     &VALUE_NEW(VALUE_NATIVE, wisp_set));
-    env_insert(env, string("car"),     &VALUE_NEW(VALUE_NATIVE, wisp_car));
-    env_insert(env, string("cdr"),     &VALUE_NEW(VALUE_NATIVE, wisp_cdr));
-    env_insert(env, string("range"),   &VALUE_NEW(VALUE_NATIVE, wisp_range));
-    env_insert(env, string("append"),  &VALUE_NEW(VALUE_NATIVE, wisp_append));
-    env_insert(env, string("t"),       &VALUE_NEW(VALUE_INTEGER, 1));
-    env_insert(env, string("nil"),     &VALUE_NEW(VALUE_NIL, 0));
+    env_insert(env, symbol_intern(string("+")),       &VALUE_NEW(VALUE_NATIVE, wisp_add));
+    env_insert(env, symbol_intern(string("-")),       &VALUE_NEW(VALUE_NATIVE, wisp_sub));
+    env_insert(env, symbol_intern(string("*")),       &VALUE_NEW(VALUE_NATIVE, wisp_mul));
+    env_insert(env, symbol_intern(string("/")),       &VALUE_NEW(VALUE_NATIVE, wisp_div));
+    env_insert(env, symbol_intern(string("=")),       &VALUE_NEW(VALUE_NATIVE, wisp_eq));
+    env_insert(env, symbol_intern(string("/=")),      &VALUE_NEW(VALUE_NATIVE, wisp_neq));
+    env_insert(env, symbol_intern(string("<")),       &VALUE_NEW(VALUE_NATIVE, wisp_lt));
+    env_insert(env, symbol_intern(string("<=")),      &VALUE_NEW(VALUE_NATIVE, wisp_lte));
+    env_insert(env, symbol_intern(string(">")),       &VALUE_NEW(VALUE_NATIVE, wisp_gt));
+    env_insert(env, symbol_intern(string(">=")),      &VALUE_NEW(VALUE_NATIVE, wisp_gte));
+    env_insert(env, symbol_intern(string("hello")),   &VALUE_NEW(VALUE_NATIVE, wisp_hello));
+    env_insert(env, symbol_intern(string("print")),   &VALUE_NEW(VALUE_NATIVE, wisp_print));
+    env_insert(env, symbol_intern(string("println")), &VALUE_NEW(VALUE_NATIVE, wisp_println));
+    env_insert(env, symbol_intern(string("set")),     &VALUE_NEW(VALUE_NATIVE, wisp_set));
+    env_insert(env, symbol_intern(string("car")),     &VALUE_NEW(VALUE_NATIVE, wisp_car));
+    env_insert(env, symbol_intern(string("cdr")),     &VALUE_NEW(VALUE_NATIVE, wisp_cdr));
+    env_insert(env, symbol_intern(string("range")),   &VALUE_NEW(VALUE_NATIVE, wisp_range));
+    env_insert(env, symbol_intern(string("append")),  &VALUE_NEW(VALUE_NATIVE, wisp_append));
+    env_insert(env, symbol_intern(string("promise")),       &VALUE_NEW(VALUE_NATIVE, wisp_promise));
+    env_insert(env, symbol_intern(string("force")),         &VALUE_NEW(VALUE_NATIVE, wisp_force));
+    env_insert(env, symbol_intern(string("lazy-cons")),     &VALUE_NEW(VALUE_NATIVE, wisp_lazy_cons));
+    env_insert(env, symbol_intern(string("map")),           &VALUE_NEW(VALUE_NATIVE, wisp_map));
+    env_insert(env, symbol_intern(string("filter")),        &VALUE_NEW(VALUE_NATIVE, wisp_filter));
+    env_insert(env, symbol_intern(string("reduce")),        &VALUE_NEW(VALUE_NATIVE, wisp_reduce));
+    env_insert(env, symbol_intern(string("mapping")),       &VALUE_NEW(VALUE_NATIVE, wisp_mapping));
+    env_insert(env, symbol_intern(string("filtering")),     &VALUE_NEW(VALUE_NATIVE, wisp_filtering));
+    env_insert(env, symbol_intern(string("taking")),        &VALUE_NEW(VALUE_NATIVE, wisp_taking));
+    env_insert(env, symbol_intern(string("pipeline")),      &VALUE_NEW(VALUE_NATIVE, wisp_pipeline));
+    env_insert(env, symbol_intern(string("transduce")),     &VALUE_NEW(VALUE_NATIVE, wisp_transduce));
+    env_insert(env, symbol_intern(string("sequence")),      &VALUE_NEW(VALUE_NATIVE, wisp_sequence));
+    env_insert(env, symbol_intern(string("vector")),        &VALUE_NEW(VALUE_NATIVE, wisp_vector));
+    env_insert(env, symbol_intern(string("vector-push!")),  &VALUE_NEW(VALUE_NATIVE, wisp_vector_push));
+    env_insert(env, symbol_intern(string("vector-ref")),    &VALUE_NEW(VALUE_NATIVE, wisp_vector_ref));
+    env_insert(env, symbol_intern(string("vector-set!")),   &VALUE_NEW(VALUE_NATIVE, wisp_vector_set));
+    env_insert(env, symbol_intern(string("vector-length")), &VALUE_NEW(VALUE_NATIVE, wisp_vector_length));
+    env_insert(env, symbol_intern(string("i64-array")),     &VALUE_NEW(VALUE_NATIVE, wisp_i64_array));
+    env_insert(env, symbol_intern(string("f64-array")),     &VALUE_NEW(VALUE_NATIVE, wisp_f64_array));
+    env_insert(env, symbol_intern(string("sum")),           &VALUE_NEW(VALUE_NATIVE, wisp_sum));
+    env_insert(env, symbol_intern(string("min")),           &VALUE_NEW(VALUE_NATIVE, wisp_min));
+    env_insert(env, symbol_intern(string("max")),           &VALUE_NEW(VALUE_NATIVE, wisp_max));
+    env_insert(env, symbol_intern(string("dot")),           &VALUE_NEW(VALUE_NATIVE, wisp_dot));
+    env_insert(env, symbol_intern(string("array-ref")),     &VALUE_NEW(VALUE_NATIVE, wisp_array_ref));
+    env_insert(env, symbol_intern(string("array-length")),  &VALUE_NEW(VALUE_NATIVE, wisp_array_length));
+    env_insert(env, symbol_intern(string("t")),       value_int(1, NULL));
+    env_insert(env, symbol_intern(string("nil")),     WISP_NIL);
 
     Gc* gc = gc_new();
+    Vm* vm = walk ? NULL : vm_new(env, gc);
 
-    if (argc < 2) {
+    Tree_Vec kept = {0};
+
+    if (file_arg == NULL) {
         gc_set_mode(gc, REPL);
         lexer = lexer_new(arena, string(""));
         parser = parser_new(arena, lexer);
 
         while (1) {
-            if (gc->mode == AUTOMATIC ||
-                gc->mode == REPL) {
-                gc_collect(gc, env);
-            }
+            gc_maybe_collect(gc, env);
 
             line.data = readline("Wisp> ");
             if (line.data == NULL) {
-                ast_free(parser->ast);
                 free(line.data);
                 break;
             }
 
             add_history(line.data);
+            line.len = strlen(line.data);
 
             parser_set_src(parser, line);
             parser_parse(parser);
 
-            // ast_print(parser->ast);
-
-            Value* val = ast_eval(parser->ast, env, gc);
-            ast_free(parser->ast);
+            // ast_print(parser->tree, parser->ast);
 
+            Value* val = eval_prog(parser->tree, parser->ast, vm, env, gc);
 
             printf("\n");
             value_print(val);
             printf("\n");
 
-            parser->ast = NULL;
+            // The whole line goes at once, the compiled chunks don't point into it
+            release_ast(&kept, parser_detach(parser));
             parser->lexer->line_number++;
 
             free(line.data);
@@ -85,20 +185,34 @@ i32 main(i32 argc, char** argv) {
     }
     else {
         gc_set_mode(gc, INTERPRET);
-        String file_path = string(argv[1]);
-        String src = string_slurp_file_malloc(file_path);
+        String file_path = string(file_arg);
+        Source src = source_open(file_path);
 
-        lexer = lexer_new(arena, src);
+        lexer = lexer_new(arena, src.text);
         parser = parser_new(arena, lexer);
 
-        parser_parse(parser);
-        ast_eval(parser->ast, env, gc);
-        ast_free(parser->ast);
-        free(src.data);
+        // Each form runs as soon as it's parsed and is freed right
+        // after, unless the walker's closures still point into it
+        AST_Id form;
+        while ((form = parser_next_form(parser)) != AST_NONE) {
+            eval_form(parser->tree, form, vm, env, gc);
+            release_ast(&kept, parser_detach(parser));
+        }
+
+        source_close(&src);
     }
 
+    // Closures the gc frees still count down their chunk's or tree's refs
     env_free(env);
     gc_free(gc);
+    if (vm) vm_free(vm);
+    ast_tree_free(parser->tree);
+    for (usize i = 0; i < kept.len; ++i) {
+        ast_tree_free(kept.at[i]);
+    }
+    free(kept.at);
     arena_free(arena);
+    symbol_table_free();
+    pool_release_all();
     return 0;
 }
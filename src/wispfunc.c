@@ -1,5 +1,7 @@
 #include "include/wispfunc.h"
+#include "include/array.h"
 #include "include/env.h"
+#include "include/gc.h"
 #include "include/value.h"
 #include <Pigeon/defines.h>
 #include <stdio.h>
@@ -9,83 +11,107 @@
     return v;\
 } while (0);
 
+// Two args with an array among them go element-wise
+static bool array_args(Value_Vec args) {
+    return args.len == 2 &&
+           (value_tag(args.at[0]) == VALUE_ARRAY || value_tag(args.at[1]) == VALUE_ARRAY);
+}
+
 Value* wisp_add(Gc* gc, Env* env, Value_Vec args) {
     (void)env;
 
     if (args.len == 0) {
-        RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+        return WISP_NIL;
+    }
+
+    if (array_args(args)) {
+        return array_binary(gc, ARRAY_ADD, args.at[0], args.at[1]);
     }
 
     i64 acc = 0;
 
     for (usize i = 0; i < args.len; ++i) {
-        acc += VALUE_GET(args.at[i], VALUE_INTEGER);
+        acc += value_as_int(args.at[i]);
     }
 
-    RETURN_VALUE(VALUE_NEW(VALUE_INTEGER, acc), gc);
+    return value_int(acc, gc);
 }
 
 Value* wisp_sub(Gc* gc, Env* env, Value_Vec args) {
     (void)env;
 
     if (args.len == 0) {
-        RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+        return WISP_NIL;
     }
 
-    i64 acc = VALUE_GET(args.at[0], VALUE_INTEGER);
+    if (array_args(args)) {
+        return array_binary(gc, ARRAY_SUB, args.at[0], args.at[1]);
+    }
+
+    i64 acc = value_as_int(args.at[0]);
 
     if (args.len == 1) {
-        RETURN_VALUE(VALUE_NEW(VALUE_INTEGER, -1*acc), gc);
+        return value_int(-1*acc, gc);
     }
 
     for (usize i = 1; i < args.len; ++i) {
-        acc -= VALUE_GET(args.at[i], VALUE_INTEGER);
+        acc -= value_as_int(args.at[i]);
     }
 
-    RETURN_VALUE(VALUE_NEW(VALUE_INTEGER, acc), gc);
+    return value_int(acc, gc);
 }
 
 Value* wisp_div(Gc* gc, Env* env, Value_Vec args) {
     (void)env;
 
     if (args.len == 0) {
-        RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+        return WISP_NIL;
     }
 
-    f64 top = VALUE_GET(args.at[0], VALUE_INTEGER);
+    if (array_args(args)) {
+        return array_binary(gc, ARRAY_DIV, args.at[0], args.at[1]);
+    }
+
+    f64 top = value_as_int(args.at[0]);
     f64 bottom = 1;
 
     for (usize i = 1; i < args.len; ++i) {
-        bottom *= VALUE_GET(args.at[i], VALUE_INTEGER);
+        bottom *= value_as_int(args.at[i]);
     }
 
-    RETURN_VALUE(VALUE_NEW(VALUE_REAL, top / bottom), gc);
+    return value_real(top / bottom, gc);
 }
 
 Value* wisp_mul(Gc* gc, Env* env, Value_Vec args) {
     (void)env;
 
     if (args.len == 0) {
-        RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+        return WISP_NIL;
+    }
+
+    if (array_args(args)) {
+        return array_binary(gc, ARRAY_MUL, args.at[0], args.at[1]);
     }
 
-    i64 acc = VALUE_GET(args.at[0], VALUE_INTEGER);
+    i64 acc = value_as_int(args.at[0]);
 
     for (usize i = 1; i < args.len; ++i) {
-        acc *= VALUE_GET(args.at[i], VALUE_INTEGER);
+        acc *= value_as_int(args.at[i]);
     }
 
-    RETURN_VALUE(VALUE_NEW(VALUE_INTEGER, acc), gc);
+    return value_int(acc, gc);
 }
 
 Value* wisp_hello(Gc* gc, Env* env, Value_Vec args) {
+    (void)gc;
     (void)args;
     (void)env;
     printf("Hello from C!\n");
-    RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+    return WISP_NIL;
 }
 
 Value* wisp_print(Gc* gc, Env* env, Value_Vec args) {
+    (void)gc;
     (void)env;
     for (usize i = 0; i < args.len; ++i) {
         value_print(args.at[i]);
@@ -95,10 +121,11 @@ Value* wisp_print(Gc* gc, Env* env, Value_Vec args) {
         }
     }
 
-    RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+    return WISP_NIL;
 }
 
 Value* wisp_println(Gc* gc, Env* env, Value_Vec args) {
+    (void)gc;
     (void)env;
     for (usize i = 0; i < args.len; ++i) {
         value_print(args.at[i]);
@@ -106,27 +133,32 @@ Value* wisp_println(Gc* gc, Env* env, Value_Vec args) {
         printf("\n");
     }
 
-    RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+    return WISP_NIL;
 }
 
 Value* wisp_set(Gc* gc, Env* env, Value_Vec args) {
-    if (args.len != 2) {
-        RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+    if (args.len != 2 || value_tag(args.at[0]) != VALUE_SYM) {
+        return WISP_NIL;
     }
 
-    String var = VALUE_GET(args.at[0], VALUE_SYM);
+    Symbol* var = VALUE_GET(args.at[0], VALUE_SYM);
     env_insert(env, var, args.at[1]);
+    gc_write_barrier(gc, env, args.at[1]);
      
-    RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+    return WISP_NIL;
 }
 
 Value* wisp_eq(Gc* gc, Env* env, Value_Vec args) {
     (void)env;
 
     if (args.len < 2) {
-        RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+        return WISP_NIL;
     } 
 
+    if (array_args(args)) {
+        return array_binary(gc, ARRAY_EQ, args.at[0], args.at[1]);
+    }
+
     i64 a_val;
     i64 b_val;
 
@@ -134,24 +166,28 @@ Value* wisp_eq(Gc* gc, Env* env, Value_Vec args) {
         Value* a = args.at[i-1];
         Value* b = args.at[i];
 
-        a_val = VALUE_GET(a, VALUE_INTEGER);
-        b_val = VALUE_GET(b, VALUE_INTEGER);
+        a_val = value_as_int(a);
+        b_val = value_as_int(b);
 
         if (a_val != b_val) {
-            RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+            return WISP_NIL;
         }
     }
     
-    RETURN_VALUE(VALUE_NEW(VALUE_INTEGER, 1), gc);
+    return value_int(1, gc);
 }
 
 Value* wisp_neq(Gc* gc, Env* env, Value_Vec args) {
     (void)env;
 
     if (args.len < 2) {
-        RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+        return WISP_NIL;
     } 
 
+    if (array_args(args)) {
+        return array_binary(gc, ARRAY_NEQ, args.at[0], args.at[1]);
+    }
+
     i64 a_val;
     i64 b_val;
 
@@ -159,24 +195,28 @@ Value* wisp_neq(Gc* gc, Env* env, Value_Vec args) {
         Value* a = args.at[i-1];
         Value* b = args.at[i];
 
-        a_val = VALUE_GET(a, VALUE_INTEGER);
-        b_val = VALUE_GET(b, VALUE_INTEGER);
+        a_val = value_as_int(a);
+        b_val = value_as_int(b);
 
         if (a_val == b_val) {
-            RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+            return WISP_NIL;
         }
     }
     
-    RETURN_VALUE(VALUE_NEW(VALUE_INTEGER, 1), gc);
+    return value_int(1, gc);
 }
 
 Value* wisp_lt(Gc* gc, Env* env, Value_Vec args) {
     (void)env;
 
     if (args.len < 2) {
-        RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+        return WISP_NIL;
     } 
 
+    if (array_args(args)) {
+        return array_binary(gc, ARRAY_LT, args.at[0], args.at[1]);
+    }
+
     i64 a_val;
     i64 b_val;
 
@@ -184,24 +224,28 @@ Value* wisp_lt(Gc* gc, Env* env, Value_Vec args) {
         Value* a = args.at[i-1];
         Value* b = args.at[i];
 
-        a_val = VALUE_GET(a, VALUE_INTEGER);
-        b_val = VALUE_GET(b, VALUE_INTEGER);
+        a_val = value_as_int(a);
+        b_val = value_as_int(b);
 
         if (a_val >= b_val) {
-            RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+            return WISP_NIL;
         }
     }
 
-    RETURN_VALUE(VALUE_NEW(VALUE_INTEGER, 1), gc);
+    return value_int(1, gc);
 }
 
 Value* wisp_lte(Gc* gc, Env* env, Value_Vec args) {
     (void)env;
 
     if (args.len < 2) {
-        RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+        return WISP_NIL;
     } 
 
+    if (array_args(args)) {
+        return array_binary(gc, ARRAY_LTE, args.at[0], args.at[1]);
+    }
+
     i64 a_val;
     i64 b_val;
 
@@ -209,24 +253,28 @@ Value* wisp_lte(Gc* gc, Env* env, Value_Vec args) {
         Value* a = args.at[i-1];
         Value* b = args.at[i];
 
-        a_val = VALUE_GET(a, VALUE_INTEGER);
-        b_val = VALUE_GET(b, VALUE_INTEGER);
+        a_val = value_as_int(a);
+        b_val = value_as_int(b);
 
         if (a_val > b_val) {
-            RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+            return WISP_NIL;
         }
     }
 
-    RETURN_VALUE(VALUE_NEW(VALUE_INTEGER, 1), gc);
+    return value_int(1, gc);
 }
 
 Value* wisp_gt(Gc* gc, Env* env, Value_Vec args) {
     (void)env;
 
     if (args.len < 2) {
-        RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+        return WISP_NIL;
     } 
 
+    if (array_args(args)) {
+        return array_binary(gc, ARRAY_GT, args.at[0], args.at[1]);
+    }
+
     i64 a_val;
     i64 b_val;
 
@@ -234,24 +282,28 @@ Value* wisp_gt(Gc* gc, Env* env, Value_Vec args) {
         Value* a = args.at[i-1];
         Value* b = args.at[i];
 
-        a_val = VALUE_GET(a, VALUE_INTEGER);
-        b_val = VALUE_GET(b, VALUE_INTEGER);
+        a_val = value_as_int(a);
+        b_val = value_as_int(b);
 
         if (a_val <= b_val) {
-            RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+            return WISP_NIL;
         }
     }
     
-    RETURN_VALUE(VALUE_NEW(VALUE_INTEGER, 1), gc);
+    return value_int(1, gc);
 }
 
 Value* wisp_gte(Gc* gc, Env* env, Value_Vec args) {
     (void)env;
 
     if (args.len < 2) {
-        RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+        return WISP_NIL;
     } 
 
+    if (array_args(args)) {
+        return array_binary(gc, ARRAY_GTE, args.at[0], args.at[1]);
+    }
+
     i64 a_val;
     i64 b_val;
 
@@ -259,93 +311,505 @@ Value* wisp_gte(Gc* gc, Env* env, Value_Vec args) {
         Value* a = args.at[i-1];
         Value* b = args.at[i];
 
-        a_val = VALUE_GET(a, VALUE_INTEGER);
-        b_val = VALUE_GET(b, VALUE_INTEGER);
+        a_val = value_as_int(a);
+        b_val = value_as_int(b);
 
         if (a_val < b_val) {
-            RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+            return WISP_NIL;
         }
     }
     
-    RETURN_VALUE(VALUE_NEW(VALUE_INTEGER, 1), gc);
+    return value_int(1, gc);
 }
 
+// Lazy, the numbers are only made as something walks it
 Value* wisp_range(Gc* gc, Env* env, Value_Vec args) {
     (void)env;
 
     if (args.len < 2) {
-        RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+        return WISP_NIL;
     }
 
-    i64 bottom = VALUE_GET(args.at[0], VALUE_INTEGER);
-    i64 top = VALUE_GET(args.at[1], VALUE_INTEGER);
-
-    i64 step = 1;
+    Range r = {value_as_int(args.at[0]), value_as_int(args.at[1]), 1};
 
     if (args.len == 3) {
-        step = VALUE_GET(args.at[2], VALUE_INTEGER);
+        r.step = value_as_int(args.at[2]);
+    }
+
+    RETURN_VALUE(VALUE_NEW(VALUE_RANGE, r), gc);
+}
+
+Value* wisp_car (Gc* gc, Env* env, Value_Vec args) {
+    (void)gc;
+    (void)env;
+
+    if (args.len != 1) {
+        return WISP_NIL;
     }
 
-    Value_Vec* vec = value_vec_new();
+    Value* seq = args.at[0];
 
-    for (i64 i = bottom; i < top; i += step) {
-        Value* number = value_alloc(VALUE_NEW(VALUE_INTEGER, i), gc);
-        value_vec_append(vec, number);
+    switch (value_tag(seq)) {
+        case VALUE_LIST: {
+            Value_Vec* vec = VALUE_GET(seq, VALUE_LIST);
+            return vec->len > 0 ? vec->at[0] : WISP_NIL;
+        }
+        case VALUE_RANGE: {
+            Range r = VALUE_GET(seq, VALUE_RANGE);
+            return range_len(r) > 0 ? value_int(r.start, gc) : WISP_NIL;
+        }
+        case VALUE_SEQ: {
+            return VALUE_GET(seq, VALUE_SEQ);
+        }
+        default: {
+            return WISP_NIL;
+        }
     }
+}
 
-    RETURN_VALUE(VALUE_NEW(VALUE_LIST, vec), gc);
+Value* wisp_cdr (Gc* gc, Env* env, Value_Vec args) {
+    if (args.len != 1) {
+        return WISP_NIL;
+    }
+
+    switch (value_tag(args.at[0])) {
+        case VALUE_LIST: {
+            // The rest shares the list's items, walking a list with cdr
+            // doesn't copy it over and over
+            Value_Vec* list = VALUE_GET(args.at[0], VALUE_LIST);
+            Value_Vec* vec = list->len > 0 ? value_vec_slice(args.at[0], 1) : value_vec_new(0);
+
+            RETURN_VALUE(VALUE_NEW(VALUE_LIST, vec), gc);
+        }
+        case VALUE_RANGE: {
+            Range r = VALUE_GET(args.at[0], VALUE_RANGE);
+            if (range_len(r) > 0) {
+                r.start += r.step;
+            }
+
+            RETURN_VALUE(VALUE_NEW(VALUE_RANGE, r), gc);
+        }
+        case VALUE_SEQ: {
+            return value_force(gc, env, args.at[0]->val.VALUE_SEQ.tail);
+        }
+        default: {
+            return WISP_NIL;
+        }
+    }
 }
 
-Value* wisp_car (Gc* gc, Env* env, Value_Vec args) {
+// Takes anything that can be walked, the result is always a list
+Value* wisp_append (Gc* gc, Env* env, Value_Vec args) {
+    if (args.len < 2) {
+        return WISP_NIL;
+    }
+
+    usize len = 0;
+    switch (value_tag(args.at[0])) {
+        case VALUE_LIST:   len = VALUE_GET(args.at[0], VALUE_LIST)->len; break;
+        case VALUE_VECTOR: len = VALUE_GET(args.at[0], VALUE_VECTOR)->len; break;
+        case VALUE_RANGE:  len = range_len(VALUE_GET(args.at[0], VALUE_RANGE)); break;
+        case VALUE_ARRAY:  len = VALUE_GET(args.at[0], VALUE_ARRAY)->len; break;
+        case VALUE_SEQ:    break;
+        default:           return WISP_NIL;
+    }
+
+    // Rooted, forcing the sequence may collect
+    Value* list = value_alloc(VALUE_NEW(VALUE_LIST, value_vec_new(len + args.len - 1)), gc);
+    u64 base = gc_push_root(gc, list);
+
+    Value_Iter it;
+    Value* item;
+    value_iter_start(&it, gc, env, args.at[0]);
+    while (value_iter_next(&it, &item)) {
+        value_push(gc, gc->roots[base], item);
+    }
+
+    list = gc->roots[base];
+    for (usize i = 1; i < args.len; ++i) {
+        value_push(gc, list, args.at[i]);
+    }
+
+    gc_pop_roots(gc, base);
+    return list;
+}
+
+// What (delay e) turns into, a promise of calling thunk
+Value* wisp_promise (Gc* gc, Env* env, Value_Vec args) {
     (void)env;
 
     if (args.len != 1) {
-        RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+        return WISP_NIL;
     }
 
+    RETURN_VALUE(VALUE_NEW(VALUE_PROMISE, args.at[0], false), gc);
+}
+
+Value* wisp_force (Gc* gc, Env* env, Value_Vec args) {
+    if (args.len != 1) {
+        return WISP_NIL;
+    }
+
+    return value_force(gc, env, args.at[0]);
+}
 
-    Value_Vec* vec = VALUE_GET(args.at[0], VALUE_LIST);
+// (lazy-cons head (delay rest)), car and cdr take it apart
+Value* wisp_lazy_cons (Gc* gc, Env* env, Value_Vec args) {
+    (void)env;
 
-    if (vec->len == 0) {
-        RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+    if (args.len != 2) {
+        return WISP_NIL;
     }
 
-    RETURN_VALUE(*vec->at[0], gc);
+    RETURN_VALUE(VALUE_NEW(VALUE_SEQ, args.at[0], args.at[1]), gc);
 }
 
-Value* wisp_cdr (Gc* gc, Env* env, Value_Vec args) {
+Value* wisp_vector (Gc* gc, Env* env, Value_Vec args) {
+    (void)env;
+
+    Value_Vec* vec = value_vec_new(args.len);
+    for (usize i = 0; i < args.len; ++i) {
+        value_vec_append(vec, args.at[i]);
+    }
+
+    RETURN_VALUE(VALUE_NEW(VALUE_VECTOR, vec), gc);
+}
+
+// Grows the vector in place, the buffer doubles when it's full
+Value* wisp_vector_push (Gc* gc, Env* env, Value_Vec args) {
     (void)env;
 
-    if (args.len != 1 || args.at[0]->tag != VALUE_LIST) {
-        RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+    if (args.len < 2 || value_tag(args.at[0]) != VALUE_VECTOR) {
+        return WISP_NIL;
     }
 
-    Value_Vec* list = VALUE_GET(args.at[0], VALUE_LIST);
-    Value_Vec* vec = value_vec_new();
+    for (usize i = 1; i < args.len; ++i) {
+        value_push(gc, args.at[0], args.at[i]);
+    }
 
-    for (usize i = 1; i < list->len; ++i) {
-        value_vec_append(vec, list->at[i]);
+    return args.at[0];
+}
+
+// The vector and the index, NULL if either is no good
+static Value** vector_slot(Value_Vec args) {
+    if (args.len < 2 || value_tag(args.at[0]) != VALUE_VECTOR || value_tag(args.at[1]) != VALUE_INTEGER) {
+        return NULL;
+    }
+
+    Value_Vec* vec = VALUE_GET(args.at[0], VALUE_VECTOR);
+    i64 index = value_as_int(args.at[1]);
+
+    if (index < 0 || (u64)index >= vec->len) {
+        return NULL;
     }
 
-    RETURN_VALUE(VALUE_NEW(VALUE_LIST, vec), gc);
+    return &vec->at[index];
 }
 
-Value* wisp_append (Gc* gc, Env* env, Value_Vec args) {
+Value* wisp_vector_ref (Gc* gc, Env* env, Value_Vec args) {
+    (void)gc;
     (void)env;
-    if (args.len < 2 || args.at[0]->tag != VALUE_LIST) {
-        RETURN_VALUE(VALUE_NEW(VALUE_NIL, 0), gc);
+
+    Value** slot = vector_slot(args);
+    if (args.len != 2 || slot == NULL) {
+        return WISP_NIL;
     }
 
-    Value_Vec* vec = VALUE_GET(args.at[0], VALUE_LIST);
-    Value_Vec* new_vec = value_vec_new();
+    return *slot;
+}
+
+Value* wisp_vector_set (Gc* gc, Env* env, Value_Vec args) {
+    (void)env;
 
-    for (usize i = 0; i < vec->len; ++i) {
-        value_vec_append(new_vec, vec->at[i]);
+    Value** slot = vector_slot(args);
+    if (args.len != 3 || slot == NULL) {
+        return WISP_NIL;
     }
 
-    for (usize i = 1; i < args.len; ++i) {
-        value_vec_append(new_vec, args.at[i]);
+    *slot = args.at[2];
+    gc_write_barrier_value(gc, args.at[0], args.at[2]);
+
+    return WISP_NIL;
+}
+
+Value* wisp_vector_length (Gc* gc, Env* env, Value_Vec args) {
+    (void)env;
+
+    if (args.len != 1 || value_tag(args.at[0]) != VALUE_VECTOR) {
+        return WISP_NIL;
+    }
+
+    return value_int(VALUE_GET(args.at[0], VALUE_VECTOR)->len, gc);
+}
+
+// The one loop behind map, filter, reduce and transduce. Each item of
+// coll goes through every stage before the next one is pulled, so no
+// list is made between them. Stages come in kind, arg pairs. What gets
+// through is handed to rf with the acc, or added to a new list when rf
+// is NULL. Without a seed the first item through becomes the acc.
+//
+// Any call may collect, so everything is kept on the shadow stack and
+// read back from there: rf, acc, the item in flight, then the stages.
+static Value* pipeline_run(Gc* gc, Env* env, Value_Vec stages, Value* rf, Value* init, bool seeded, Value* coll) {
+    bool collect = rf == NULL;
+    if (collect) {
+        init = value_alloc(VALUE_NEW(VALUE_LIST, value_vec_new(0)), gc);
+        seeded = true;
+    }
+
+    u64 base = gc_push_root(gc, collect ? WISP_NIL : rf);
+    u64 acc = gc_push_root(gc, init);
+    u64 cur = gc_push_root(gc, WISP_NIL);
+    for (usize i = 0; i < stages.len; ++i) {
+        gc_push_root(gc, stages.at[i]);
+    }
+    Value** stage = &gc->roots[cur + 1];
+
+    Value_Iter it;
+    Value* item;
+    bool done = false;
+    value_iter_start(&it, gc, env, coll);
+
+    while (!done && value_iter_next(&it, &item)) {
+        gc->roots[cur] = item;
+        Value_Vec arg = {&gc->roots[cur], 1, 1, NULL};
+        bool keep = true;
+
+        for (usize i = 0; i < stages.len && keep; i += 2) {
+            switch (value_as_int(stage[i])) {
+                case XFORM_MAP: {
+                    gc->roots[cur] = value_call(gc, env, stage[i + 1], arg);
+                    break;
+                }
+                case XFORM_FILTER: {
+                    keep = value_call(gc, env, stage[i + 1], arg) != WISP_NIL;
+                    break;
+                }
+                case XFORM_TAKE: {
+                    // The count left lives in this run's copy of the stage
+                    i64 left = value_as_int(stage[i + 1]);
+                    if (left <= 0) {
+                        keep = false;
+                        done = true;
+                        break;
+                    }
+
+                    stage[i + 1] = value_int(left - 1, gc);
+                    done = done || left == 1;
+                    break;
+                }
+            }
+        }
+
+        if (!keep) {
+            continue;
+        }
+
+        if (collect) {
+            value_push(gc, gc->roots[acc], gc->roots[cur]);
+        } else if (!seeded) {
+            gc->roots[acc] = gc->roots[cur];
+            seeded = true;
+        } else {
+            Value* pair[2] = {gc->roots[acc], gc->roots[cur]};
+            gc->roots[acc] = value_call(gc, env, gc->roots[base], (Value_Vec){pair, 2, 2, NULL});
+        }
+    }
+
+    // Nothing came through and there was nothing to start from
+    if (!seeded) {
+        gc->roots[acc] = value_call(gc, env, gc->roots[base], (Value_Vec){0});
+    }
+
+    Value* result = gc->roots[acc];
+    gc_pop_roots(gc, base);
+    return result;
+}
+
+// Clears coll's slot in the caller's frame, the iterator keeps its own
+// root. Otherwise the head of a lazy sequence would keep every item
+// forced so far alive until the walk is over.
+static Value* take_coll(Value_Vec args) {
+    Value* coll = args.at[args.len - 1];
+    args.at[args.len - 1] = WISP_NIL;
+    return coll;
+}
+
+static Value* xform_new(Gc* gc, XformKind kind, Value* arg) {
+    Value_Vec* stages = value_vec_new(2);
+    value_vec_append(stages, value_int(kind, gc));
+    value_vec_append(stages, arg);
+
+    RETURN_VALUE(VALUE_NEW(VALUE_XFORM, stages), gc);
+}
+
+// Eager, they walk all of coll. Use a pipeline with taking on a
+// sequence that doesn't end.
+Value* wisp_map (Gc* gc, Env* env, Value_Vec args) {
+    if (args.len != 2) {
+        return WISP_NIL;
+    }
+
+    Value* stages[2] = {value_int(XFORM_MAP, gc), args.at[0]};
+    return pipeline_run(gc, env, (Value_Vec){stages, 2, 2, NULL}, NULL, WISP_NIL, false, take_coll(args));
+}
+
+Value* wisp_filter (Gc* gc, Env* env, Value_Vec args) {
+    if (args.len != 2) {
+        return WISP_NIL;
+    }
+
+    Value* stages[2] = {value_int(XFORM_FILTER, gc), args.at[0]};
+    return pipeline_run(gc, env, (Value_Vec){stages, 2, 2, NULL}, NULL, WISP_NIL, false, take_coll(args));
+}
+
+// (reduce f coll) or (reduce f init coll)
+Value* wisp_reduce (Gc* gc, Env* env, Value_Vec args) {
+    if (args.len != 2 && args.len != 3) {
+        return WISP_NIL;
+    }
+
+    bool seeded = args.len == 3;
+    Value* init = seeded ? args.at[1] : WISP_NIL;
+    return pipeline_run(gc, env, (Value_Vec){0}, args.at[0], init, seeded, take_coll(args));
+}
+
+Value* wisp_mapping (Gc* gc, Env* env, Value_Vec args) {
+    (void)env;
+    return args.len == 1 ? xform_new(gc, XFORM_MAP, args.at[0]) : WISP_NIL;
+}
+
+Value* wisp_filtering (Gc* gc, Env* env, Value_Vec args) {
+    (void)env;
+    return args.len == 1 ? xform_new(gc, XFORM_FILTER, args.at[0]) : WISP_NIL;
+}
+
+Value* wisp_taking (Gc* gc, Env* env, Value_Vec args) {
+    (void)env;
+
+    if (args.len != 1 || value_tag(args.at[0]) != VALUE_INTEGER) {
+        return WISP_NIL;
+    }
+
+    return xform_new(gc, XFORM_TAKE, args.at[0]);
+}
+
+// (pipeline xf ...) runs the stages of each one in order
+Value* wisp_pipeline (Gc* gc, Env* env, Value_Vec args) {
+    (void)env;
+
+    usize len = 0;
+    for (usize i = 0; i < args.len; ++i) {
+        if (value_tag(args.at[i]) != VALUE_XFORM) {
+            return WISP_NIL;
+        }
+        len += VALUE_GET(args.at[i], VALUE_XFORM)->len;
     }
 
-    RETURN_VALUE(VALUE_NEW(VALUE_LIST, new_vec), gc);
+    Value_Vec* stages = value_vec_new(len);
+    for (usize i = 0; i < args.len; ++i) {
+        Value_Vec* xf = VALUE_GET(args.at[i], VALUE_XFORM);
+        for (usize j = 0; j < xf->len; ++j) {
+            value_vec_append(stages, xf->at[j]);
+        }
+    }
+
+    RETURN_VALUE(VALUE_NEW(VALUE_XFORM, stages), gc);
+}
+
+// (transduce xf f coll) or (transduce xf f init coll), reduce with
+// every item going through xf on the way
+Value* wisp_transduce (Gc* gc, Env* env, Value_Vec args) {
+    if ((args.len != 3 && args.len != 4) || value_tag(args.at[0]) != VALUE_XFORM) {
+        return WISP_NIL;
+    }
+
+    bool seeded = args.len == 4;
+    Value* init = seeded ? args.at[2] : WISP_NIL;
+    return pipeline_run(gc, env, *VALUE_GET(args.at[0], VALUE_XFORM), args.at[1], init, seeded, take_coll(args));
+}
+
+// (sequence xf coll), the items that make it through xf as a list
+Value* wisp_sequence (Gc* gc, Env* env, Value_Vec args) {
+    if (args.len != 2 || value_tag(args.at[0]) != VALUE_XFORM) {
+        return WISP_NIL;
+    }
+
+    return pipeline_run(gc, env, *VALUE_GET(args.at[0], VALUE_XFORM), NULL, WISP_NIL, false, take_coll(args));
+}
+
+// (i64-array 1 2 3) packs its args, (i64-array xs) converts a list,
+// vector, range, lazy sequence or other array
+static Value* array_args_new(Gc* gc, Env* env, ArrayKind kind, Value_Vec args) {
+    if (args.len == 1 && value_tag(args.at[0]) != VALUE_INTEGER && value_tag(args.at[0]) != VALUE_REAL) {
+        return array_from(gc, env, kind, args.at[0]);
+    }
+
+    return array_pack(gc, kind, args);
+}
+
+Value* wisp_i64_array (Gc* gc, Env* env, Value_Vec args) {
+    return array_args_new(gc, env, ARRAY_I64, args);
+}
+
+Value* wisp_f64_array (Gc* gc, Env* env, Value_Vec args) {
+    return array_args_new(gc, env, ARRAY_F64, args);
+}
+
+static Array* array_arg(Value_Vec args) {
+    if (args.len != 1 || value_tag(args.at[0]) != VALUE_ARRAY) {
+        return NULL;
+    }
+    return VALUE_GET(args.at[0], VALUE_ARRAY);
+}
+
+Value* wisp_sum (Gc* gc, Env* env, Value_Vec args) {
+    (void)env;
+    Array* arr = array_arg(args);
+    return arr ? array_sum(gc, arr) : WISP_NIL;
+}
+
+Value* wisp_min (Gc* gc, Env* env, Value_Vec args) {
+    (void)env;
+    Array* arr = array_arg(args);
+    return arr ? array_min(gc, arr) : WISP_NIL;
+}
+
+Value* wisp_max (Gc* gc, Env* env, Value_Vec args) {
+    (void)env;
+    Array* arr = array_arg(args);
+    return arr ? array_max(gc, arr) : WISP_NIL;
+}
+
+Value* wisp_dot (Gc* gc, Env* env, Value_Vec args) {
+    (void)env;
+
+    if (args.len != 2 || value_tag(args.at[0]) != VALUE_ARRAY || value_tag(args.at[1]) != VALUE_ARRAY) {
+        return WISP_NIL;
+    }
+
+    return array_dot(gc, VALUE_GET(args.at[0], VALUE_ARRAY), VALUE_GET(args.at[1], VALUE_ARRAY));
+}
+
+Value* wisp_array_ref (Gc* gc, Env* env, Value_Vec args) {
+    (void)env;
+
+    if (args.len != 2 || value_tag(args.at[0]) != VALUE_ARRAY || value_tag(args.at[1]) != VALUE_INTEGER) {
+        return WISP_NIL;
+    }
+
+    Array* arr = VALUE_GET(args.at[0], VALUE_ARRAY);
+    i64 index = value_as_int(args.at[1]);
+
+    if (index < 0 || (u64)index >= arr->len) {
+        return WISP_NIL;
+    }
+
+    return array_item(arr, index, gc);
+}
+
+Value* wisp_array_length (Gc* gc, Env* env, Value_Vec args) {
+    (void)env;
+    Array* arr = array_arg(args);
+    return arr ? value_int(arr->len, gc) : WISP_NIL;
 }
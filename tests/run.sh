@@ -0,0 +1,17 @@
+#!/bin/sh
+# Runs every tests/*.wisp under both backends and diffs against tests/*.out
+# usage: tests/run.sh [path/to/wisp]
+WISP=${1:-bin/wisp}
+DIR=$(dirname "$0")
+fail=0
+for src in "$DIR"/*.wisp; do
+    out=${src%.wisp}.out
+    for mode in "" --walk; do
+        if ! "$WISP" $mode "$src" 2>&1 | diff -u "$out" - > /dev/null; then
+            echo "FAIL ${src##*/} ${mode:-(vm)}"
+            fail=1
+        fi
+    done
+done
+[ $fail = 0 ] && echo "all tests passed"
+exit $fail